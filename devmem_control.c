@@ -0,0 +1,265 @@
+#include "devmem_control.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// 制御スレッドの停止確認間隔（ミリ秒）
+#define CONTROL_POLL_INTERVAL_MS 250
+
+// 1行の最大長
+#define CONTROL_LINE_MAX 256
+
+// 1行を受信（改行は取り除く）
+// 制御チャネルは低頻度なので1バイトずつ読む
+static int read_line(int fd, char *buf, size_t len) {
+  size_t pos = 0;
+
+  while (pos + 1 < len) {
+    char ch;
+    ssize_t ret = recv(fd, &ch, 1, 0);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret == 0) {
+      errno = ENOTCONN; // 切断（受信タイムアウトのEAGAINと区別する）
+      return -1;
+    }
+    if (ret < 0) {
+      return -1;
+    }
+    if (ch == '\n') {
+      break;
+    }
+    if (ch != '\r') {
+      buf[pos++] = ch;
+    }
+  }
+  buf[pos] = '\0';
+  return pos;
+}
+
+static int send_line(int fd, const char *line) {
+  size_t len = strlen(line);
+  return send(fd, line, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+// 1コマンドを処理して応答を返す
+static void handle_command(struct devmem_control_server *c, int fd,
+                           char *line) {
+  char reply[CONTROL_LINE_MAX];
+  char *saveptr = NULL;
+  char *cmd = strtok_r(line, " ", &saveptr);
+
+  if (!cmd) {
+    send_line(fd, "ERR empty command\n");
+    return;
+  }
+
+  if (strcmp(cmd, "SET") == 0) {
+    char *key = strtok_r(NULL, " ", &saveptr);
+    char *value = strtok_r(NULL, " ", &saveptr);
+    char *end;
+    long long v, applied;
+
+    if (!key || !value) {
+      send_line(fd, "ERR usage: SET <key> <value>\n");
+      return;
+    }
+    v = strtoll(value, &end, 0);
+    applied = v;
+    if (*end != '\0' || c->set(c->arg, key, v, &applied) < 0) {
+      snprintf(reply, sizeof(reply), "ERR cannot set %s to %s\n", key, value);
+      send_line(fd, reply);
+      return;
+    }
+    if (applied != v) {
+      printf("Control: %s = %lld (effective %lld)\n", key, v, applied);
+    } else {
+      printf("Control: %s = %lld\n", key, v);
+    }
+    fflush(stdout);
+    snprintf(reply, sizeof(reply), "OK %lld\n", applied);
+    send_line(fd, reply);
+  } else if (strcmp(cmd, "STATS") == 0) {
+    devmem_stats_update_usage(c->stats);
+    snprintf(reply, sizeof(reply),
+             "STATS bytes=%llu cpu_us=%llu tokens_outstanding=%lld\n",
+             (unsigned long long)STATS_LOAD(c->stats, bytes_total),
+             (unsigned long long)(STATS_LOAD(c->stats, cpu_user_us) +
+                                  STATS_LOAD(c->stats, cpu_sys_us)),
+             (long long)(STATS_LOAD(c->stats, tokens_received) -
+                         STATS_LOAD(c->stats, tokens_released)));
+    send_line(fd, reply);
+  } else {
+    send_line(fd, "ERR unknown command\n");
+  }
+}
+
+static void *control_thread(void *arg) {
+  struct devmem_control_server *c = arg;
+  struct pollfd pfd = {.fd = c->listen_fd, .events = POLLIN};
+
+  // 同時に扱うクライアントは1つ（自動調整を行うクライアント）
+  while (__atomic_load_n(&c->running, __ATOMIC_RELAXED)) {
+    int ret = poll(&pfd, 1, CONTROL_POLL_INTERVAL_MS);
+    if (ret < 0 && errno != EINTR) {
+      perror("control poll failed");
+      break;
+    }
+    if (ret <= 0 || !(pfd.revents & POLLIN)) {
+      continue;
+    }
+
+    int fd = accept(c->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+
+    // 停止要求を確認できるよう受信にタイムアウトを付ける
+    struct timeval tv = {.tv_sec = 0,
+                         .tv_usec = CONTROL_POLL_INTERVAL_MS * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char line[CONTROL_LINE_MAX];
+    while (__atomic_load_n(&c->running, __ATOMIC_RELAXED)) {
+      if (read_line(fd, line, sizeof(line)) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          continue;
+        }
+        break;
+      }
+      handle_command(c, fd, line);
+    }
+    close(fd);
+  }
+
+  return NULL;
+}
+
+int devmem_control_start(struct devmem_control_server *c, int listen_fd,
+                         struct devmem_stats *stats, devmem_control_set_fn set,
+                         void *arg) {
+  memset(c, 0, sizeof(*c));
+  c->listen_fd = listen_fd;
+  c->stats = stats;
+  c->set = set;
+  c->arg = arg;
+
+  // シグナルはデータパス側のスレッドで受ける
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+
+  c->running = 1;
+  int ret = pthread_create(&c->thread, NULL, control_thread, c);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to create control thread\n");
+    c->running = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void devmem_control_stop(struct devmem_control_server *c) {
+  if (!c->running) {
+    return;
+  }
+  __atomic_store_n(&c->running, 0, __ATOMIC_RELAXED);
+  pthread_join(c->thread, NULL);
+  close(c->listen_fd);
+  c->listen_fd = -1;
+}
+
+int devmem_control_connect(const char *host, int port) {
+  struct addrinfo hints, *res, *ai;
+  char port_str[16];
+  int fd = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  if (getaddrinfo(host, port_str, &hints, &res) != 0) {
+    return -1;
+  }
+
+  for (ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  return fd;
+}
+
+long long devmem_control_set(int fd, const char *key, long long value) {
+  char line[CONTROL_LINE_MAX];
+  long long applied = value;
+
+  snprintf(line, sizeof(line), "SET %s %lld\n", key, value);
+  if (send_line(fd, line) < 0 || read_line(fd, line, sizeof(line)) < 0) {
+    return -1;
+  }
+  if (strncmp(line, "OK", 2) != 0 || (line[2] != '\0' && line[2] != ' ')) {
+    fprintf(stderr, "Control: %s\n", line);
+    return -1;
+  }
+  if (line[2] == ' ') {
+    applied = strtoll(line + 3, NULL, 0);
+  }
+  return applied;
+}
+
+int devmem_set_buffer_size(int fd, int optname, int bytes) {
+  int force = optname == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE;
+  int value;
+  socklen_t len = sizeof(value);
+
+  // 特権が無い場合は通常の設定（上限で黙って丸められる）
+  if (setsockopt(fd, SOL_SOCKET, force, &bytes, sizeof(bytes)) < 0 &&
+      setsockopt(fd, SOL_SOCKET, optname, &bytes, sizeof(bytes)) < 0) {
+    return -1;
+  }
+  if (getsockopt(fd, SOL_SOCKET, optname, &value, &len) < 0) {
+    return -1;
+  }
+  // カーネルは管理領域の分として設定値の2倍を保持して返す
+  return value / 2;
+}
+
+int devmem_control_get_stats(int fd, struct devmem_control_stats *out) {
+  char line[CONTROL_LINE_MAX];
+  unsigned long long bytes, cpu_us;
+  long long outstanding;
+
+  if (send_line(fd, "STATS\n") < 0 || read_line(fd, line, sizeof(line)) < 0) {
+    return -1;
+  }
+  if (sscanf(line, "STATS bytes=%llu cpu_us=%llu tokens_outstanding=%lld",
+             &bytes, &cpu_us, &outstanding) != 3) {
+    return -1;
+  }
+  out->bytes = bytes;
+  out->cpu_us = cpu_us;
+  out->tokens_outstanding = outstanding;
+  return 0;
+}
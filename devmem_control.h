@@ -0,0 +1,60 @@
+#ifndef DEVMEM_CONTROL_H
+#define DEVMEM_CONTROL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "devmem_metrics.h"
+
+// 自動調整用の制御チャネル
+// クライアントがサーバー側の設定（受信バッファ等）を変更し、
+// 試行ごとのサーバーCPU時間を取得するための1行単位のテキストプロトコル
+//
+//   SET <key> <value>  ->  OK <applied> | ERR <reason>
+//                          （applied は実際に効く値、例えばカーネルが丸めたバッファサイズ）
+//   STATS              ->  STATS bytes=<n> cpu_us=<n> tokens_outstanding=<n>
+
+// SETコマンドの処理関数（成功時0、未対応のキーや不正な値は-1）
+// applied には実際に効く値を返す（呼び出し前に value で初期化済み）
+typedef int (*devmem_control_set_fn)(void *arg, const char *key,
+                                     long long value, long long *applied);
+
+// 制御サーバーの状態
+struct devmem_control_server {
+  pthread_t thread;
+  int listen_fd;
+  int running;
+  struct devmem_stats *stats;
+  devmem_control_set_fn set;
+  void *arg;
+};
+
+// サーバーが返す累積値
+struct devmem_control_stats {
+  uint64_t bytes;
+  uint64_t cpu_us; // ユーザー+システム
+  int64_t tokens_outstanding;
+};
+
+// 制御スレッドを開始（listen_fd はリッスン済みのソケット、停止時にcloseする）
+int devmem_control_start(struct devmem_control_server *c, int listen_fd,
+                         struct devmem_stats *stats, devmem_control_set_fn set,
+                         void *arg);
+
+// 制御スレッドを停止
+void devmem_control_stop(struct devmem_control_server *c);
+
+// 制御ポートに接続（失敗時は-1）
+int devmem_control_connect(const char *host, int port);
+
+// サーバー側の設定を変更し、実際に効く値を返す（失敗時は-1）
+long long devmem_control_set(int fd, const char *key, long long value);
+
+// SO_RCVBUF/SO_SNDBUF を設定し、実際に効くサイズを返す（失敗時は-1）
+// CAP_NET_ADMINがあれば *BUFFORCE で net.core.[rw]mem_max の上限を超えて設定する
+int devmem_set_buffer_size(int fd, int optname, int bytes);
+
+// サーバーの累積値を取得
+int devmem_control_get_stats(int fd, struct devmem_control_stats *out);
+
+#endif // DEVMEM_CONTROL_H
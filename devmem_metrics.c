@@ -0,0 +1,338 @@
+#include "devmem_metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// メトリクススレッドの更新間隔（ミリ秒）
+#define METRICS_POLL_INTERVAL_MS 250
+
+// メトリクスの定義
+struct devmem_metric_desc {
+  const char *name;
+  const char *type;
+  const char *help;
+  size_t offset;
+  int is_signed;
+  double scale; // 出力時に掛ける係数
+};
+
+#define METRIC(name, type, help, field, is_signed, scale)                      \
+  {name, type, help, offsetof(struct devmem_stats, field), is_signed, scale}
+
+static const struct devmem_metric_desc metric_descs[] = {
+    METRIC("bytes_total", "counter", "Payload bytes transferred", bytes_total,
+           0, 1.0),
+    METRIC("packets_total", "counter", "Successful send/recv calls",
+           packets_total, 0, 1.0),
+    METRIC("devmem_bytes_total", "counter",
+           "Bytes received into device memory", devmem_bytes, 0, 1.0),
+    METRIC("linear_bytes_total", "counter",
+           "Bytes received into linear buffers", linear_bytes, 0, 1.0),
+    METRIC("tokens_received_total", "counter", "devmem frag tokens received",
+           tokens_received, 0, 1.0),
+    METRIC("tokens_released_total", "counter",
+           "devmem frag tokens returned with SO_DEVMEM_DONTNEED",
+           tokens_released, 0, 1.0),
+    METRIC("token_release_errors_total", "counter",
+           "SO_DEVMEM_DONTNEED failures", token_release_errors, 0, 1.0),
+    METRIC("connections_total", "counter", "Connections established",
+           connections_total, 0, 1.0),
+    METRIC("connections_active", "gauge", "Connections currently open",
+           connections_active, 1, 1.0),
+    METRIC("errors_total", "counter", "Socket errors on the data path",
+           errors_total, 0, 1.0),
+    METRIC("cpu_user_seconds_total", "counter", "User CPU time", cpu_user_us,
+           0, 1e-6),
+    METRIC("cpu_system_seconds_total", "counter", "System CPU time",
+           cpu_sys_us, 0, 1e-6),
+    METRIC("resident_memory_bytes", "gauge", "Resident set size", rss_bytes,
+           0, 1.0),
+};
+
+static int64_t monotonic_time_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// このプロセスが作成した共有メモリ上のカウンタ（終了時に削除するのはこれだけ）
+static struct devmem_stats *shared_stats;
+
+struct devmem_stats *devmem_stats_open(const char *name) {
+  struct devmem_stats *stats = MAP_FAILED;
+
+  if (name && name[0]) {
+    // 既存のセグメントは別のインスタンスのもの（初期化や削除をしない）
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST) {
+      fprintf(stderr,
+              "Shared memory segment %s already exists: another instance is "
+              "using it (choose another name with --shm) or it is stale "
+              "(remove /dev/shm%s)\n",
+              name, name);
+      return NULL;
+    }
+    if (fd < 0) {
+      perror("shm_open failed");
+    } else {
+      if (ftruncate(fd, sizeof(*stats)) < 0) {
+        perror("ftruncate failed");
+      } else {
+        stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+        if (stats == MAP_FAILED) {
+          perror("mmap failed");
+        }
+      }
+      close(fd);
+      if (stats == MAP_FAILED) {
+        shm_unlink(name);
+      } else {
+        shared_stats = stats;
+      }
+    }
+  }
+
+  // 共有メモリが使えない場合はプロセス内メモリで継続
+  if (stats == MAP_FAILED) {
+    stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+      perror("mmap failed");
+      return NULL;
+    }
+  }
+
+  memset(stats, 0, sizeof(*stats));
+  stats->magic = DEVMEM_STATS_MAGIC;
+  stats->version = DEVMEM_STATS_VERSION;
+  stats->start_time_us = monotonic_time_us();
+
+  return stats;
+}
+
+void devmem_stats_close(struct devmem_stats *stats, const char *name) {
+  if (!stats) {
+    return;
+  }
+  if (stats == shared_stats && name && name[0]) {
+    shm_unlink(name);
+    shared_stats = NULL;
+  }
+  munmap(stats, sizeof(*stats));
+}
+
+void devmem_stats_update_usage(struct devmem_stats *stats) {
+  struct rusage ru;
+  long pages = 0, rss_pages = 0;
+
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    __atomic_store_n(&stats->cpu_user_us,
+                     ru.ru_utime.tv_sec * 1000000ULL + ru.ru_utime.tv_usec,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->cpu_sys_us,
+                     ru.ru_stime.tv_sec * 1000000ULL + ru.ru_stime.tv_usec,
+                     __ATOMIC_RELAXED);
+  }
+
+  // 現在のRSS（リーク検出用。ru_maxrssはピーク値のため使わない）
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp) {
+    if (fscanf(fp, "%ld %ld", &pages, &rss_pages) == 2) {
+      __atomic_store_n(&stats->rss_bytes,
+                       (uint64_t)rss_pages * sysconf(_SC_PAGESIZE),
+                       __ATOMIC_RELAXED);
+    }
+    fclose(fp);
+  }
+}
+
+int devmem_metrics_format(struct devmem_stats *stats, const char *role,
+                          char *buf, size_t len) {
+  size_t pos = 0;
+  int n;
+
+#define APPEND(...)                                                            \
+  do {                                                                         \
+    n = snprintf(buf + pos, len - pos, __VA_ARGS__);                           \
+    if (n < 0 || (size_t)n >= len - pos) {                                     \
+      return pos;                                                              \
+    }                                                                          \
+    pos += n;                                                                  \
+  } while (0)
+
+  for (size_t i = 0; i < sizeof(metric_descs) / sizeof(metric_descs[0]); i++) {
+    const struct devmem_metric_desc *d = &metric_descs[i];
+    const char *field = (const char *)stats + d->offset;
+    double value;
+
+    if (d->is_signed) {
+      value = __atomic_load_n((const int64_t *)field, __ATOMIC_RELAXED);
+    } else {
+      value = __atomic_load_n((const uint64_t *)field, __ATOMIC_RELAXED);
+    }
+
+    APPEND("# HELP devmem_%s_%s %s\n", role, d->name, d->help);
+    APPEND("# TYPE devmem_%s_%s %s\n", role, d->name, d->type);
+    APPEND("devmem_%s_%s %.15g\n", role, d->name, value * d->scale);
+  }
+
+  // 返却されていないトークン数（リーク検出用）
+  APPEND("# HELP devmem_%s_tokens_outstanding devmem frag tokens not yet "
+         "released\n",
+         role);
+  APPEND("# TYPE devmem_%s_tokens_outstanding gauge\n", role);
+  APPEND("devmem_%s_tokens_outstanding %lld\n", role,
+         (long long)(STATS_LOAD(stats, tokens_received) -
+                     STATS_LOAD(stats, tokens_released)));
+
+  APPEND("# HELP devmem_%s_uptime_seconds Time since the process started\n",
+         role);
+  APPEND("# TYPE devmem_%s_uptime_seconds gauge\n", role);
+  APPEND("devmem_%s_uptime_seconds %.3f\n", role,
+         (monotonic_time_us() - stats->start_time_us) / 1000000.0);
+
+#undef APPEND
+
+  return pos;
+}
+
+// 1つのスクレイプ要求に応答
+static void serve_scrape(struct devmem_metrics_server *m, int fd) {
+  char request[1024];
+  char body[8192];
+  char header[256];
+  int body_len, header_len;
+
+  // リクエスト内容は問わない（パスに関係なくメトリクスを返す）
+  struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  if (recv(fd, request, sizeof(request), 0) <= 0) {
+    return;
+  }
+
+  devmem_stats_update_usage(m->stats);
+  body_len = devmem_metrics_format(m->stats, m->role, body, sizeof(body));
+  header_len = snprintf(header, sizeof(header),
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %d\r\n"
+                        "Connection: close\r\n\r\n",
+                        body_len);
+
+  if (send(fd, header, header_len, MSG_NOSIGNAL) == header_len) {
+    send(fd, body, body_len, MSG_NOSIGNAL);
+  }
+}
+
+static void *metrics_thread(void *arg) {
+  struct devmem_metrics_server *m = arg;
+  struct pollfd pfd = {.fd = m->listen_fd, .events = POLLIN};
+
+  while (__atomic_load_n(&m->running, __ATOMIC_RELAXED)) {
+    int ret = poll(&pfd, m->listen_fd >= 0 ? 1 : 0, METRICS_POLL_INTERVAL_MS);
+    if (ret < 0 && errno != EINTR) {
+      perror("poll failed");
+      break;
+    }
+
+    // 共有メモリ読み取り側のためにCPU時間とRSSを定期的に更新
+    devmem_stats_update_usage(m->stats);
+
+    if (ret > 0 && (pfd.revents & POLLIN)) {
+      int fd = accept(m->listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        serve_scrape(m, fd);
+        close(fd);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int devmem_metrics_start(struct devmem_metrics_server *m,
+                         struct devmem_stats *stats, const char *role,
+                         int port) {
+  memset(m, 0, sizeof(*m));
+  m->listen_fd = -1;
+  m->stats = stats;
+  m->role = role;
+
+  if (port > 0) {
+    struct sockaddr_in addr;
+    int opt = 1;
+
+    m->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m->listen_fd < 0) {
+      perror("metrics socket creation failed");
+      return -1;
+    }
+    setsockopt(m->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // データパスに影響しないようlocalhostのみで待ち受ける
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(m->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(m->listen_fd, 4) < 0) {
+      perror("metrics bind/listen failed");
+      close(m->listen_fd);
+      m->listen_fd = -1;
+      return -1;
+    }
+  }
+
+  // シグナルはデータパス側のスレッドで受けるため、メトリクススレッドでは
+  // ブロックしておく（recvmsg等をEINTRで中断させるため）
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+
+  m->running = 1;
+  int ret = pthread_create(&m->thread, NULL, metrics_thread, m);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to create metrics thread\n");
+    if (m->listen_fd >= 0) {
+      close(m->listen_fd);
+    }
+    m->listen_fd = -1;
+    m->running = 0;
+    return -1;
+  }
+
+  if (port > 0) {
+    printf("Metrics endpoint: http://127.0.0.1:%d/metrics\n", port);
+  }
+
+  return 0;
+}
+
+void devmem_metrics_stop(struct devmem_metrics_server *m) {
+  if (!m->running) {
+    return;
+  }
+  __atomic_store_n(&m->running, 0, __ATOMIC_RELAXED);
+  pthread_join(m->thread, NULL);
+  if (m->listen_fd >= 0) {
+    close(m->listen_fd);
+    m->listen_fd = -1;
+  }
+  devmem_stats_update_usage(m->stats);
+}
@@ -0,0 +1,71 @@
+#ifndef DEVMEM_METRICS_H
+#define DEVMEM_METRICS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+// 長時間実行（デーモンモード）用の共有メモリカウンタと
+// Prometheus形式のメトリクスエンドポイント
+
+#define DEVMEM_STATS_MAGIC 0x444d5354 // "DMST"
+#define DEVMEM_STATS_VERSION 1
+
+// 共有メモリ上のカウンタ（外部ツールからもshm_openで参照できる）
+// データパスからは STATS_ADD でのみ更新する
+struct devmem_stats {
+  uint32_t magic;
+  uint32_t version;
+  int64_t start_time_us;
+  uint64_t bytes_total;
+  uint64_t packets_total;
+  uint64_t devmem_bytes;
+  uint64_t linear_bytes;
+  uint64_t tokens_received;
+  uint64_t tokens_released;
+  uint64_t token_release_errors;
+  uint64_t connections_total;
+  int64_t connections_active;
+  uint64_t errors_total;
+  // 以下はメトリクススレッドが定期的に更新する
+  uint64_t cpu_user_us;
+  uint64_t cpu_sys_us;
+  uint64_t rss_bytes;
+};
+
+#define STATS_ADD(s, field, n)                                                 \
+  __atomic_fetch_add(&(s)->field, (n), __ATOMIC_RELAXED)
+#define STATS_LOAD(s, field) __atomic_load_n(&(s)->field, __ATOMIC_RELAXED)
+
+// メトリクスサーバーの状態
+struct devmem_metrics_server {
+  pthread_t thread;
+  int listen_fd;
+  int running;
+  struct devmem_stats *stats;
+  const char *role; // メトリクス名の接頭辞（"server" / "client"）
+};
+
+// 共有メモリセグメントを新規作成してカウンタを初期化
+// name が NULL または空の場合、もしくは作成に失敗した場合はプロセス内メモリを使う
+// 同名のセグメントが既に存在する場合はエラーを表示してNULL
+struct devmem_stats *devmem_stats_open(const char *name);
+
+// カウンタを解放（このプロセスが作成したセグメントの場合は削除）
+void devmem_stats_close(struct devmem_stats *stats, const char *name);
+
+// CPU時間とRSSを更新
+void devmem_stats_update_usage(struct devmem_stats *stats);
+
+// Prometheusテキスト形式でカウンタを書き出し、書き込んだバイト数を返す
+int devmem_metrics_format(struct devmem_stats *stats, const char *role,
+                          char *buf, size_t len);
+
+// メトリクススレッドを開始（port が 0 の場合はリッスンせず使用量の更新のみ）
+int devmem_metrics_start(struct devmem_metrics_server *m,
+                         struct devmem_stats *stats, const char *role,
+                         int port);
+
+// メトリクススレッドを停止
+void devmem_metrics_stop(struct devmem_metrics_server *m);
+
+#endif // DEVMEM_METRICS_H
@@ -0,0 +1,355 @@
+#!/bin/bash
+
+# Device Memory TCP ネットワーク名前空間テストハーネス
+# 使用方法: sudo ./devmem_netns_test.sh [num_queues] [duration_sec]
+#
+# 2つのネットワーク名前空間をマルチキューのvethペアで接続し、
+# サーバー/クライアントを別々のcpuset cgroupに固定してモードの組み合わせを実行する。
+# NICが無くてもGRO/TSO/キュー/XPSを通る経路で比較できる。
+#
+# 環境変数:
+#   MTU              vethのMTU（既定: 9000）
+#   GRO / TSO        on/off（既定: on）
+#   QDISC            vethのroot qdisc（既定: fq、"none" で変更しない）
+#   SERVER_CPUS      サーバー側cpuset（既定: 0）
+#   CLIENT_CPUS      クライアント側cpuset（既定: 1、CPUが1つならサーバーと同じ）
+#   DATA_SIZE        クライアントの送信サイズ（既定: 65536）
+#   MATRIX_FAMILIES  "4 6"（既定）
+#   MATRIX_DEVMEM    "0 1"（既定、vethではdevmem送信は失敗として記録される）
+#   MATRIX_WAIT      "block busypoll epoll spin"（既定）
+#   MATRIX_STREAMS   "1 <num_queues>"（既定）
+#   RESULTS_DIR      結果の出力先（既定: results/netns）
+#   KEEP_TOPOLOGY=1  終了時に名前空間とcgroupを削除しない
+
+set -e
+
+NUM_QUEUES=${1:-4}
+DURATION=${2:-5}
+
+SCRIPT_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+SERVER_BIN=${SERVER_BIN:-$SCRIPT_DIR/devmem_server}
+CLIENT_BIN=${CLIENT_BIN:-$SCRIPT_DIR/devmem_client}
+
+NS_SERVER=devmem_srv
+NS_CLIENT=devmem_cli
+VETH_SERVER=veth_srv
+VETH_CLIENT=veth_cli
+SERVER_ADDR4=10.200.0.1
+CLIENT_ADDR4=10.200.0.2
+SERVER_ADDR6=fd00:200::1
+CLIENT_ADDR6=fd00:200::2
+PORT=5201
+
+MTU=${MTU:-9000}
+GRO=${GRO:-on}
+TSO=${TSO:-on}
+QDISC=${QDISC:-fq}
+SERVER_CPUS=${SERVER_CPUS:-0}
+if [ -z "$CLIENT_CPUS" ]; then
+    if [ "$(nproc)" -gt 1 ]; then
+        CLIENT_CPUS=1
+    else
+        CLIENT_CPUS=0
+    fi
+fi
+DATA_SIZE=${DATA_SIZE:-65536}
+MATRIX_FAMILIES=${MATRIX_FAMILIES:-4 6}
+MATRIX_DEVMEM=${MATRIX_DEVMEM:-0 1}
+MATRIX_WAIT=${MATRIX_WAIT:-block busypoll epoll spin}
+MATRIX_STREAMS=${MATRIX_STREAMS:-1 $NUM_QUEUES}
+RESULTS_DIR=${RESULTS_DIR:-results/netns}
+
+CGROUP_ROOT=/sys/fs/cgroup
+CGROUP_SERVER=$CGROUP_ROOT/devmem_server
+CGROUP_CLIENT=$CGROUP_ROOT/devmem_client
+USE_CGROUPS=0
+# devmem_tcp_setup.sh が追加したntupleルールIDの記録先（名前空間と一緒に削除する）
+RULES_STATE_FILE=/run/devmem_netns_test.$VETH_SERVER.rules
+CPUSET_ENABLED=0
+
+# 必要なパッケージのチェック
+check_dependencies() {
+    echo "Checking dependencies..."
+
+    if [ "$EUID" -ne 0 ]; then
+        echo "Error: This script must be run as root"
+        exit 1
+    fi
+
+    for CMD in ip tc ss; do
+        if ! command -v $CMD &> /dev/null; then
+            echo "Error: $CMD is not installed"
+            exit 1
+        fi
+    done
+
+    if ! command -v ethtool &> /dev/null; then
+        echo "Warning: ethtool is not installed. Offload settings will be skipped."
+    fi
+
+    if [ ! -x "$SERVER_BIN" ] || [ ! -x "$CLIENT_BIN" ]; then
+        echo "Error: $SERVER_BIN / $CLIENT_BIN not found. Run 'make all' first."
+        exit 1
+    fi
+
+    # cgroup v2（cpuset）の確認
+    if [ -f $CGROUP_ROOT/cgroup.controllers ] && grep -qw cpuset $CGROUP_ROOT/cgroup.controllers; then
+        USE_CGROUPS=1
+    else
+        echo "Warning: cgroup v2 cpuset controller not available. Falling back to taskset."
+    fi
+}
+
+# 名前空間とvethペアの作成
+setup_topology() {
+    echo "Creating namespaces $NS_SERVER / $NS_CLIENT with $NUM_QUEUES-queue veth pair..."
+
+    ip netns add $NS_SERVER
+    ip netns add $NS_CLIENT
+
+    ip link add $VETH_SERVER numtxqueues $NUM_QUEUES numrxqueues $NUM_QUEUES type veth \
+        peer name $VETH_CLIENT numtxqueues $NUM_QUEUES numrxqueues $NUM_QUEUES
+    ip link set $VETH_SERVER netns $NS_SERVER
+    ip link set $VETH_CLIENT netns $NS_CLIENT
+
+    for SIDE in server client; do
+        if [ $SIDE = server ]; then
+            NS=$NS_SERVER; DEV=$VETH_SERVER; ADDR4=$SERVER_ADDR4; ADDR6=$SERVER_ADDR6
+        else
+            NS=$NS_CLIENT; DEV=$VETH_CLIENT; ADDR4=$CLIENT_ADDR4; ADDR6=$CLIENT_ADDR6
+        fi
+        ip -n $NS link set lo up
+        ip -n $NS link set $DEV mtu $MTU
+        ip -n $NS addr add $ADDR4/24 dev $DEV
+        ip -n $NS addr add $ADDR6/64 dev $DEV nodad
+        ip -n $NS link set $DEV up
+    done
+}
+
+# オフロード、qdisc、XPSの設定
+setup_offloads() {
+    echo "Configuring offloads (GRO=$GRO, TSO=$TSO), qdisc ($QDISC) and XPS..."
+
+    for SIDE in server client; do
+        if [ $SIDE = server ]; then
+            NS=$NS_SERVER; DEV=$VETH_SERVER; CPUS=$SERVER_CPUS
+        else
+            NS=$NS_CLIENT; DEV=$VETH_CLIENT; CPUS=$CLIENT_CPUS
+        fi
+
+        if command -v ethtool &> /dev/null; then
+            ip netns exec $NS ethtool -K $DEV gro $GRO tso $TSO 2>/dev/null || {
+                echo "Warning: Could not set offloads on $DEV"
+            }
+        fi
+
+        if [ "$QDISC" != "none" ]; then
+            ip netns exec $NS tc qdisc replace dev $DEV root $QDISC 2>/dev/null || {
+                echo "Warning: Could not set qdisc $QDISC on $DEV"
+            }
+        fi
+
+        # XPS: 送信キューiをcpusetのCPUに巡回して割り当て
+        CPU_LIST=($(expand_cpu_list $CPUS))
+        for ((Q = 0; Q < NUM_QUEUES; Q++)); do
+            CPU=${CPU_LIST[$((Q % ${#CPU_LIST[@]}))]}
+            ip netns exec $NS sh -c "echo $CPU > /sys/class/net/$DEV/queues/tx-$Q/xps_cpus_list" 2>/dev/null || true
+        done
+    done
+}
+
+# "0-2,4" 形式のCPUリストを展開
+expand_cpu_list() {
+    local RANGE
+    for RANGE in ${1//,/ }; do
+        if [[ $RANGE == *-* ]]; then
+            seq ${RANGE%-*} ${RANGE#*-}
+        else
+            echo $RANGE
+        fi
+    done
+}
+
+# devmem_tcp_setup.sh のNIC設定をサーバー側vethに適用
+# （vethが対応しない項目は警告として記録される）
+setup_nic_in_namespace() {
+    echo "Applying devmem_tcp_setup.sh NIC configuration to $VETH_SERVER..."
+
+    if ! command -v ethtool &> /dev/null; then
+        echo "Warning: ethtool not found, skipping setup_nic/setup_flow_steering"
+        return
+    fi
+
+    ip netns exec $NS_SERVER bash -c "
+        export RULES_STATE='$RULES_STATE_FILE'
+        source '$SCRIPT_DIR/devmem_tcp_setup.sh' $VETH_SERVER $((NUM_QUEUES - 1))
+        set +e
+        setup_nic
+        setup_flow_steering
+    " || echo "Warning: NIC setup in namespace reported errors"
+}
+
+# cpuset cgroupの作成
+setup_cgroups() {
+    if [ $USE_CGROUPS -eq 0 ]; then
+        return
+    fi
+
+    echo "Creating cpuset cgroups (server: $SERVER_CPUS, client: $CLIENT_CPUS)..."
+
+    # 既に有効でなければ有効にし、終了時に元へ戻す
+    if ! grep -qw cpuset $CGROUP_ROOT/cgroup.subtree_control; then
+        if echo "+cpuset" > $CGROUP_ROOT/cgroup.subtree_control 2>/dev/null; then
+            CPUSET_ENABLED=1
+        fi
+    fi
+    mkdir -p $CGROUP_SERVER $CGROUP_CLIENT
+    echo $SERVER_CPUS > $CGROUP_SERVER/cpuset.cpus
+    echo $CLIENT_CPUS > $CGROUP_CLIENT/cpuset.cpus
+    # cpuset.memsは書かずに親から継承する（空なら親の全ノードを使える。
+    # CPUと別ノードのメモリに固定しないため）
+}
+
+# cgroupに入ってから名前空間でコマンドを実行
+# （ip netns exec は /sys を再マウントするため、先にcgroupへ移動する）
+# execで置き換えるため、サブシェル内（&や( )）から呼ぶこと
+run_in() {
+    local SIDE=$1
+    shift
+    local NS CGROUP CPUS
+    if [ $SIDE = server ]; then
+        NS=$NS_SERVER; CGROUP=$CGROUP_SERVER; CPUS=$SERVER_CPUS
+    else
+        NS=$NS_CLIENT; CGROUP=$CGROUP_CLIENT; CPUS=$CLIENT_CPUS
+    fi
+
+    if [ $USE_CGROUPS -eq 1 ]; then
+        exec bash -c 'echo $$ > "$0/cgroup.procs" && exec ip netns exec "$@"' $CGROUP $NS "$@"
+    else
+        exec taskset -c $CPUS ip netns exec $NS "$@"
+    fi
+}
+
+# サーバーがリッスンを開始するまで待機（固定のsleepによる競合を避ける）
+wait_for_listen() {
+    local I
+    for ((I = 0; I < 50; I++)); do
+        if ip netns exec $NS_SERVER ss -ltnH "sport = :$PORT" | grep -q LISTEN; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "Error: server did not start listening on port $PORT"
+    return 1
+}
+
+# 1つの組み合わせを実行して結果を1行にまとめる
+run_case() {
+    local FAMILY=$1 DEVMEM=$2 WAIT=$3 STREAMS=$4
+    local NAME="ipv${FAMILY}_devmem${DEVMEM}_${WAIT}_${STREAMS}streams"
+    local SERVER_LOG=$RESULTS_DIR/server_$NAME.log
+    local CLIENT_LOG=$RESULTS_DIR/client_$NAME.log
+    local SERVER_IP LOCAL
+
+    if [ $FAMILY = 6 ]; then
+        SERVER_IP=$SERVER_ADDR6; LOCAL="[$CLIENT_ADDR6]:40000"
+    else
+        SERVER_IP=$SERVER_ADDR4; LOCAL="$CLIENT_ADDR4:40000"
+    fi
+
+    echo "Running $NAME..."
+
+    run_in server $SERVER_BIN --wait-mode $WAIT --verify increment --verify-period $DATA_SIZE \
+        $PORT $((DURATION + 2)) > $SERVER_LOG 2>&1 &
+    local SERVER_PID=$!
+
+    local STATUS=ok
+    if wait_for_listen; then
+        (run_in client $CLIENT_BIN --streams $STREAMS --local $LOCAL \
+            $SERVER_IP $PORT $DATA_SIZE $DURATION $DEVMEM $VETH_CLIENT) > $CLIENT_LOG 2>&1 || STATUS=client_failed
+    else
+        STATUS=server_failed
+    fi
+
+    kill -TERM $SERVER_PID 2>/dev/null || true
+    wait $SERVER_PID 2>/dev/null || true
+
+    # サーバー側の最終結果（複数ストリーム時は合計）を抽出
+    local GOODPUT P99 CPU_COST VERIFY
+    GOODPUT=$(grep "^Goodput:" $SERVER_LOG | tail -1 | awk '{print $2}')
+    P99=$(grep "^Recv wait latency:" $SERVER_LOG | tail -1 | sed -n 's/.*p99 \([0-9.]*\) us.*/\1/p')
+    CPU_COST=$(grep "^CPU cost:" $SERVER_LOG | tail -1 | awk '{print $3}')
+    VERIFY=$(grep "^Verified bytes:" $SERVER_LOG | tail -1 | sed -n 's/.*mismatched chunks: \([0-9]*\).*/\1/p')
+
+    # vethではdevmem送信が使えないため、データが流れなかった組み合わせは失敗扱い
+    if [ $STATUS = ok ] && ! grep -q "^Total bytes received: [1-9]" $SERVER_LOG; then
+        STATUS=no_data
+    fi
+
+    echo "$FAMILY,$DEVMEM,$WAIT,$STREAMS,$STATUS,${GOODPUT:-},${P99:-},${CPU_COST:-},${VERIFY:-}" >> $RESULTS_DIR/summary.csv
+}
+
+# モードの組み合わせをすべて実行
+run_matrix() {
+    mkdir -p $RESULTS_DIR
+    echo "family,devmem,wait_mode,streams,status,goodput_mbps,recv_wait_p99_us,cpu_us_per_mb,mismatched_chunks" > $RESULTS_DIR/summary.csv
+
+    for FAMILY in $MATRIX_FAMILIES; do
+        for DEVMEM in $MATRIX_DEVMEM; do
+            for WAIT in $MATRIX_WAIT; do
+                for STREAMS in $MATRIX_STREAMS; do
+                    run_case $FAMILY $DEVMEM $WAIT $STREAMS
+                done
+            done
+        done
+    done
+}
+
+# 名前空間とcgroupの削除
+cleanup() {
+    if [ "$KEEP_TOPOLOGY" = "1" ]; then
+        echo "Keeping namespaces $NS_SERVER / $NS_CLIENT"
+        return
+    fi
+
+    echo "Cleaning up..."
+    ip netns del $NS_SERVER 2>/dev/null || true
+    ip netns del $NS_CLIENT 2>/dev/null || true
+    # ルールはvethと共に消えるため、記録も削除する（次回の実行で古いIDを消さないように）
+    rm -f $RULES_STATE_FILE
+    rmdir $CGROUP_SERVER $CGROUP_CLIENT 2>/dev/null || true
+    if [ $CPUSET_ENABLED -eq 1 ]; then
+        echo "-cpuset" > $CGROUP_ROOT/cgroup.subtree_control 2>/dev/null || {
+            echo "Warning: could not disable cpuset in $CGROUP_ROOT/cgroup.subtree_control"
+        }
+        CPUSET_ENABLED=0
+    fi
+}
+
+# メイン実行部分
+main() {
+    echo "=== Device Memory TCP netns/veth Test ==="
+    echo "Queues: $NUM_QUEUES"
+    echo "Duration: $DURATION seconds"
+    echo "MTU: $MTU, GRO: $GRO, TSO: $TSO, qdisc: $QDISC"
+    echo "CPUs: server $SERVER_CPUS, client $CLIENT_CPUS"
+    echo "=========================================="
+
+    check_dependencies
+
+    # 前回の実行が残っていれば削除
+    KEEP_TOPOLOGY=0 cleanup
+    trap cleanup EXIT
+
+    setup_topology
+    setup_offloads
+    setup_nic_in_namespace
+    setup_cgroups
+    run_matrix
+
+    echo -e "\n=== Test Matrix Summary ==="
+    column -t -s, $RESULTS_DIR/summary.csv 2>/dev/null || cat $RESULTS_DIR/summary.csv
+    echo "Logs in $RESULTS_DIR/"
+}
+
+main "$@"
@@ -1,16 +1,32 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <endian.h>
 #include <errno.h>
+#include <getopt.h>
 #include <linux/socket.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "devmem_control.h"
+#include "devmem_metrics.h"
+#include "devmem_trace.h"
+#include "devmem_workload.h"
+#include "latency_hist.h"
+#include "test_pattern.h"
+
 // devmem TCP用の構造体定義
 struct dmabuf_tx_cmsg {
   uint32_t dmabuf_id;
@@ -23,113 +39,357 @@ static inline long long get_time_us(void) {
   return tv.tv_sec * 1000000LL + tv.tv_usec;
 }
 
-// グッドプット測定クライアント
-int main(int argc, char *argv[]) {
-  int client_fd;
-  struct sockaddr_in server_addr;
-  char *server_ip = "127.0.0.1";
-  int port = 5201;
-  int data_size = 1024 * 1024;   // 1MB per send
-  int test_duration = 10;        // 測定時間（秒）
-  int use_devmem = 0;            // devmem送信を使用するか
-  char *interface_name = "eth1"; // デフォルトのインターフェース名
+// ナノ秒単位の単調時計（応答時間測定用）
+static inline long long get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#define DEFAULT_METRICS_PORT 9465
+#define DEFAULT_SHM_PREFIX "/devmem_client_stats" // デーモンモードでは .<pid> を付ける
+
+// デーモンモードで再接続を試みる間隔（マイクロ秒）
+#define RECONNECT_INTERVAL_US 1000000
+
+// 並列ストリームと送信元アドレスの最大数
+#define MAX_STREAMS 64
+#define MAX_LOCAL_ADDRS 16
+
+// 送信元アドレス（--local で指定）
+struct local_addr {
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  int port; // 0の場合はエフェメラルポート
+};
+
+// クライアント設定
+struct client_config {
+  const char *server_ip;
+  int port;
+  int data_size;        // 1回の送信サイズ
+  int test_duration;    // 測定時間（秒）
+  int use_devmem;       // devmem送信を使用するか
+  const char *interface_name;
+  int daemon_mode;      // 時間制限なしで送信し、切断時は再接続する
+  int metrics_port;     // 0の場合はエンドポイントを無効化
+  const char *shm_name;
+  int num_streams;      // 並列ストリーム数
+  struct local_addr local_addrs[MAX_LOCAL_ADDRS];
+  int num_local_addrs;  // 0の場合は送信元をカーネルに任せる
+  enum test_pattern pattern; // 送信データのパターン
+  uint64_t seed;
+  int fill_threads;     // バッファ初期化スレッド数（0: 自動）
+  int sndbuf;           // SO_SNDBUF（0: カーネルの自動調整）
+  int duration_ms;      // 0以外の場合は test_duration の代わりに使う（試行用）
+  int quiet;            // 接続・進捗の表示を抑制（自動調整の試行用）
+  int control_port;     // サーバーの制御ポート（0: 使用しない）
+};
+
+// 1接続分の統計情報
+struct conn_result {
+  long long total_bytes;
+  long long total_packets;
+  long long start_time;
+  long long end_time;
+};
+
+// ストリームごとの送信スレッド
+struct stream_worker {
+  pthread_t thread;
+  int id;
+  const struct client_config *cfg;
+  char *data;
+  int fd;      // 現在の接続（停止時にメインスレッドがshutdownする）
+  int status;  // 0: 成功, 1: 接続失敗
+  int running;
+  struct conn_result res;
+};
 
-  // 統計情報
-  long long total_bytes = 0;
-  long long total_packets = 0;
-  long long start_time, end_time;
+static struct devmem_stats *stats;
+static volatile sig_atomic_t stop_requested = 0;
 
-  if (argc > 1) {
-    server_ip = argv[1];
+// SIGTERM/SIGINT/SIGHUP: 停止要求
+static void signal_handler(int sig) {
+  (void)sig;
+  stop_requested = 1;
+}
+
+// シグナルハンドラを設定
+// SA_RESTARTを付けず、ブロッキング中のsend/connectをEINTRで中断させる
+static void setup_signals(void) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = signal_handler;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  // サーバー切断時にSIGPIPEで終了しないようにする
+  signal(SIGPIPE, SIG_IGN);
+}
+
+// 進捗表示（1秒ごと、デーモンモードでは10秒ごと）
+static void report_progress(const struct client_config *cfg,
+                            const struct conn_result *res,
+                            long long *last_report) {
+  long long report_interval = cfg->daemon_mode ? 10000000 : 1000000;
+  long long current_time = get_time_us();
+  if (!cfg->quiet && current_time - *last_report >= report_interval) {
+    double elapsed = (current_time - res->start_time) / 1000000.0;
+    double current_goodput = res->total_bytes / elapsed / 1024.0 / 1024.0 * 8.0;
+    printf("Elapsed: %.1fs, Goodput: %.2f Mbps, Packets: %lld\n", elapsed,
+           current_goodput, res->total_packets);
+    *last_report = current_time;
   }
-  if (argc > 2) {
-    port = atoi(argv[2]);
+}
+
+// "addr", "addr:port", "[v6addr]:port" 形式の送信元アドレスを解析
+static int parse_local_addr(const char *spec, struct local_addr *la) {
+  char host[INET6_ADDRSTRLEN + 2];
+  const char *port_str = NULL;
+  struct addrinfo hints, *res;
+
+  memset(la, 0, sizeof(*la));
+
+  if (spec[0] == '[') {
+    const char *end = strchr(spec, ']');
+    if (!end || (size_t)(end - spec - 1) >= sizeof(host)) {
+      return -1;
+    }
+    memcpy(host, spec + 1, end - spec - 1);
+    host[end - spec - 1] = '\0';
+    if (end[1] == ':') {
+      port_str = end + 2;
+    } else if (end[1] != '\0') {
+      return -1;
+    }
+  } else {
+    const char *colon = strchr(spec, ':');
+    // コロンが1つだけならIPv4の "addr:port"、複数ならポートなしのIPv6
+    if (colon && !strchr(colon + 1, ':')) {
+      if ((size_t)(colon - spec) >= sizeof(host)) {
+        return -1;
+      }
+      memcpy(host, spec, colon - spec);
+      host[colon - spec] = '\0';
+      port_str = colon + 1;
+    } else {
+      snprintf(host, sizeof(host), "%s", spec);
+    }
   }
-  if (argc > 3) {
-    data_size = atoi(argv[3]);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST;
+  if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+    return -1;
+  }
+  memcpy(&la->addr, res->ai_addr, res->ai_addrlen);
+  la->addr_len = res->ai_addrlen;
+  freeaddrinfo(res);
+
+  la->port = port_str ? atoi(port_str) : 0;
+  return 0;
+}
+
+// カンマ区切りの送信元アドレスリストを解析
+static int parse_local_addrs(char *list, struct client_config *cfg) {
+  char *saveptr = NULL;
+
+  cfg->num_local_addrs = 0;
+  for (char *tok = strtok_r(list, ",", &saveptr); tok;
+       tok = strtok_r(NULL, ",", &saveptr)) {
+    if (cfg->num_local_addrs >= MAX_LOCAL_ADDRS) {
+      fprintf(stderr, "Too many local addresses (max %d)\n", MAX_LOCAL_ADDRS);
+      return -1;
+    }
+    if (parse_local_addr(tok, &cfg->local_addrs[cfg->num_local_addrs]) < 0) {
+      fprintf(stderr, "Invalid local address: %s\n", tok);
+      return -1;
+    }
+    cfg->num_local_addrs++;
   }
-  if (argc > 4) {
-    test_duration = atoi(argv[4]);
+  return 0;
+}
+
+// サーバーの制御チャネル（混合ワークロードでは全フローのスレッドで共有する）
+static struct {
+  pthread_mutex_t lock;
+  int fd;
+} control = {.lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+
+// 接続前に送信元ポートを確定させ、応答要求としてサーバーに登録
+static int register_ack_port(int client_fd, int family) {
+  struct sockaddr_storage local;
+  socklen_t len = sizeof(local);
+  int port, ret;
+
+  if (getsockname(client_fd, (struct sockaddr *)&local, &len) < 0) {
+    return -1;
   }
-  if (argc > 5) {
-    use_devmem = atoi(argv[5]);
+  port = ntohs(local.ss_family == AF_INET6
+                   ? ((struct sockaddr_in6 *)&local)->sin6_port
+                   : ((struct sockaddr_in *)&local)->sin_port);
+
+  // 未バインドならワイルドカードアドレスのエフェメラルポートにバインド
+  if (port == 0) {
+    memset(&local, 0, sizeof(local));
+    local.ss_family = family;
+    len = family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                             : sizeof(struct sockaddr_in);
+    if (bind(client_fd, (struct sockaddr *)&local, len) < 0 ||
+        getsockname(client_fd, (struct sockaddr *)&local, &len) < 0) {
+      return -1;
+    }
+    port = ntohs(family == AF_INET6
+                     ? ((struct sockaddr_in6 *)&local)->sin6_port
+                     : ((struct sockaddr_in *)&local)->sin_port);
   }
-  if (argc > 6) {
-    interface_name = argv[6];
+
+  pthread_mutex_lock(&control.lock);
+  ret = devmem_control_set(control.fd, "ack_port", port) < 0 ? -1 : 0;
+  pthread_mutex_unlock(&control.lock);
+  return ret;
+}
+
+// 接続済みソケットを作成
+// 送信元アドレスはストリーム番号で決まる（アドレスを巡回し、巡回ごとにポートを1つずらす）
+// これにより4タプルが固定され、RSS/ntupleによるキューの割り当てが再現可能になる
+// ack が真の場合は受信ごとの累積受信応答をサーバーに要求する（制御チャネルが必要）
+static int connect_to_server(const struct client_config *cfg, int stream_id,
+                             int ack) {
+  const struct local_addr *la = NULL;
+  struct addrinfo hints, *res, *ai;
+  char port_str[16];
+  int client_fd = -1;
+
+  if (cfg->num_local_addrs > 0) {
+    la = &cfg->local_addrs[stream_id % cfg->num_local_addrs];
   }
 
-  printf("devmem TCP goodput client\n");
-  printf("Server: %s:%d\n", server_ip, port);
-  printf("Data size per send: %d bytes\n", data_size);
-  printf("Test duration: %d seconds\n", test_duration);
-  printf("Use devmem: %s\n", use_devmem ? "Yes" : "No");
-  printf("Interface: %s\n", interface_name);
-
-  // ソケット作成
-  client_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (client_fd < 0) {
-    perror("socket creation failed");
-    return 1;
+  // サーバーアドレス設定（送信元指定時はそのアドレスファミリに合わせる）
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = la ? la->addr.ss_family : AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  snprintf(port_str, sizeof(port_str), "%d", cfg->port);
+  int ret = getaddrinfo(cfg->server_ip, port_str, &hints, &res);
+  if (ret != 0) {
+    fprintf(stderr, "Invalid address: %s (%s)\n", cfg->server_ip,
+            gai_strerror(ret));
+    return -1;
   }
 
-  // devmem送信を使用する場合の設定
-  if (use_devmem) {
-    int opt = 1;
-    if (setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) < 0) {
-      perror("SO_ZEROCOPY failed");
-      close(client_fd);
-      return 1;
+  for (ai = res; ai; ai = ai->ai_next) {
+    // ソケット作成
+    client_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (client_fd < 0) {
+      perror("socket creation failed");
+      continue;
     }
 
-    // デバイスバインディング（実際の実装では適切なインターフェース名を使用）
-    // TODO: 実際のネットワークインターフェース名を動的に取得する
-    if (setsockopt(client_fd, SOL_SOCKET, SO_BINDTODEVICE, interface_name,
-                   strlen(interface_name) + 1) < 0) {
-      perror("SO_BINDTODEVICE failed");
-      // 警告として継続
+    // devmem送信を使用する場合の設定
+    if (cfg->use_devmem) {
+      int opt = 1;
+      if (setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) <
+          0) {
+        perror("SO_ZEROCOPY failed");
+        close(client_fd);
+        client_fd = -1;
+        break;
+      }
+
+      // デバイスバインディング（実際の実装では適切なインターフェース名を使用）
+      // TODO: 実際のネットワークインターフェース名を動的に取得する
+      if (setsockopt(client_fd, SOL_SOCKET, SO_BINDTODEVICE,
+                     cfg->interface_name,
+                     strlen(cfg->interface_name) + 1) < 0) {
+        perror("SO_BINDTODEVICE failed");
+        // 警告として継続
+      }
     }
-  }
 
-  // サーバーアドレス設定
-  memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(port);
-  if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
-    perror("Invalid address");
-    close(client_fd);
-    return 1;
-  }
+    // 送信バッファサイズ（指定時はカーネルの自動調整が無効になる）
+    if (cfg->sndbuf > 0) {
+      static int clamp_warned;
+      int effective = devmem_set_buffer_size(client_fd, SO_SNDBUF, cfg->sndbuf);
+      if (effective < 0) {
+        perror("SO_SNDBUF failed");
+        // 警告として継続
+      } else if (effective < cfg->sndbuf && !cfg->quiet &&
+                 !__atomic_exchange_n(&clamp_warned, 1, __ATOMIC_RELAXED)) {
+        fprintf(stderr,
+                "Warning: SO_SNDBUF %d clamped to %d by net.core.wmem_max "
+                "(raise it or run with CAP_NET_ADMIN)\n",
+                cfg->sndbuf, effective);
+      }
+    }
 
-  // サーバーに接続
-  if (connect(client_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) <
-      0) {
-    perror("connect failed");
-    close(client_fd);
-    return 1;
-  }
+    // 送信元アドレスとポートを固定
+    if (la) {
+      struct sockaddr_storage local = la->addr;
+      int port = la->port ? la->port + stream_id / cfg->num_local_addrs : 0;
+      int opt = 1;
+
+      if (port) {
+        setsockopt(client_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+      } else if (!ack) {
+        // ポート未指定時はconnectまでポート割り当てを遅らせる
+        // （応答要求の登録時はポートを先に確定させる必要がある）
+        setsockopt(client_fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &opt,
+                   sizeof(opt));
+      }
+      if (local.ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *)&local)->sin6_port = htons(port);
+      } else {
+        ((struct sockaddr_in *)&local)->sin_port = htons(port);
+      }
+      if (bind(client_fd, (struct sockaddr *)&local, la->addr_len) < 0) {
+        perror("bind to local address failed");
+        close(client_fd);
+        client_fd = -1;
+        continue;
+      }
+    }
 
-  printf("Connected to server\n");
+    if (ack && register_ack_port(client_fd, ai->ai_family) < 0) {
+      fprintf(stderr, "Failed to register latency acks with the server\n");
+      close(client_fd);
+      client_fd = -1;
+      continue;
+    }
 
-  // 送信データの準備
-  char *data = malloc(data_size);
-  if (!data) {
-    perror("malloc failed");
+    // サーバーに接続
+    if (connect(client_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    perror("connect failed");
     close(client_fd);
-    return 1;
+    client_fd = -1;
   }
+  freeaddrinfo(res);
 
-  // テストパターンでデータを初期化
-  for (int i = 0; i < data_size; i++) {
-    data[i] = i % 256;
-  }
+  return client_fd;
+}
 
-  // 測定開始
-  start_time = get_time_us();
-  long long measurement_end = start_time + test_duration * 1000000LL;
+// 1接続分の送信ループ
+// deadline が 0 の場合は切断または停止要求まで送信を続ける
+static void run_transmission(const struct client_config *cfg, int client_fd,
+                             char *data, long long deadline,
+                             struct conn_result *res) {
+  long long last_report = 0;
 
-  printf("Starting data transmission...\n");
+  memset(res, 0, sizeof(*res));
+  res->start_time = get_time_us();
+
+  if (!cfg->quiet) {
+    printf("Starting data transmission...\n");
+  }
 
-  if (use_devmem) {
+  if (cfg->use_devmem) {
     // devmem送信モード（実際の実装では適切なdmabuf_idを使用）
     char ctrl_data[CMSG_SPACE(sizeof(struct dmabuf_tx_cmsg))];
     struct dmabuf_tx_cmsg ddmabuf;
@@ -144,7 +404,7 @@ int main(int argc, char *argv[]) {
     // メッセージ構造体設定
     // TODO: 実際のdmabuf内のオフセットを計算する
     iov.iov_base = (void *)0; // dmabuf内のオフセット
-    iov.iov_len = data_size;
+    iov.iov_len = cfg->data_size;
     msg.msg_iov = &iov;
     msg.msg_iovlen = 1;
     msg.msg_control = ctrl_data;
@@ -159,82 +419,1489 @@ int main(int argc, char *argv[]) {
     *((struct dmabuf_tx_cmsg *)CMSG_DATA(cmsg)) = ddmabuf;
 
     // 送信ループ
-    while (get_time_us() < measurement_end) {
+    while (!stop_requested && (deadline == 0 || get_time_us() < deadline)) {
       ssize_t bytes_sent = sendmsg(client_fd, &msg, MSG_ZEROCOPY);
       if (bytes_sent < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
           usleep(1000); // 1ms待機
           continue;
         }
+        if (errno == EINTR) {
+          continue;
+        }
         perror("sendmsg failed");
+        STATS_ADD(stats, errors_total, 1);
         break;
       }
 
-      total_bytes += bytes_sent;
-      total_packets++;
+      res->total_bytes += bytes_sent;
+      res->total_packets++;
+      STATS_ADD(stats, bytes_total, bytes_sent);
+      STATS_ADD(stats, packets_total, 1);
 
       // 送信完了通知を処理（MSG_ZEROCOPY使用時）
       // TODO: 実際の実装では適切なエラーキュー処理を行う
 
-      // 1秒ごとに進捗を表示
-      static long long last_report = 0;
-      long long current_time = get_time_us();
-      if (current_time - last_report >= 1000000) {
-        double elapsed = (current_time - start_time) / 1000000.0;
-        double current_goodput = total_bytes / elapsed / 1024.0 / 1024.0 * 8.0;
-        printf("Elapsed: %.1fs, Goodput: %.2f Mbps, Packets: %lld\n", elapsed,
-               current_goodput, total_packets);
-        last_report = current_time;
-      }
+      report_progress(cfg, res, &last_report);
     }
   } else {
     // 通常の送信モード
-    while (get_time_us() < measurement_end) {
-      ssize_t bytes_sent = send(client_fd, data, data_size, 0);
+    // 部分送信時は続きから送り、ストリーム上のオフセットとパターンを一致させる
+    size_t send_offset = 0;
+    while (!stop_requested && (deadline == 0 || get_time_us() < deadline)) {
+      ssize_t bytes_sent = send(client_fd, data + send_offset,
+                                cfg->data_size - send_offset, 0);
       if (bytes_sent < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
           usleep(1000); // 1ms待機
           continue;
         }
+        if (errno == EINTR) {
+          continue;
+        }
         perror("send failed");
+        STATS_ADD(stats, errors_total, 1);
         break;
       }
 
-      total_bytes += bytes_sent;
-      total_packets++;
+      res->total_bytes += bytes_sent;
+      res->total_packets++;
+      STATS_ADD(stats, bytes_total, bytes_sent);
+      STATS_ADD(stats, packets_total, 1);
+      send_offset = (send_offset + bytes_sent) % cfg->data_size;
 
-      // 1秒ごとに進捗を表示
-      static long long last_report = 0;
-      long long current_time = get_time_us();
-      if (current_time - last_report >= 1000000) {
-        double elapsed = (current_time - start_time) / 1000000.0;
-        double current_goodput = total_bytes / elapsed / 1024.0 / 1024.0 * 8.0;
-        printf("Elapsed: %.1fs, Goodput: %.2f Mbps, Packets: %lld\n", elapsed,
-               current_goodput, total_packets);
-        last_report = current_time;
-      }
+      report_progress(cfg, res, &last_report);
     }
   }
 
-  end_time = get_time_us();
+  res->end_time = get_time_us();
+}
 
-  // 結果の計算と表示
-  double duration = (end_time - start_time) / 1000000.0;
-  double goodput_mbps = total_bytes / duration / 1024.0 / 1024.0 * 8.0;
-  double packet_rate = total_packets / duration;
+// 1接続分の結果を表示
+static void print_results(const struct conn_result *res, const char *title) {
+  double duration = (res->end_time - res->start_time) / 1000000.0;
+  double goodput_mbps = res->total_bytes / duration / 1024.0 / 1024.0 * 8.0;
+  double packet_rate = res->total_packets / duration;
 
-  printf("\n=== Transmission Results ===\n");
+  printf("\n=== %s ===\n", title);
   printf("Duration: %.3f seconds\n", duration);
-  printf("Total bytes sent: %lld bytes\n", total_bytes);
-  printf("Total packets sent: %lld packets\n", total_packets);
+  printf("Total bytes sent: %lld bytes\n", res->total_bytes);
+  printf("Total packets sent: %lld packets\n", res->total_packets);
   printf("Goodput: %.2f Mbps\n", goodput_mbps);
   printf("Packet rate: %.2f packets/sec\n", packet_rate);
   printf("Average packet size: %.1f bytes\n",
-         total_packets > 0 ? (double)total_bytes / total_packets : 0);
+         res->total_packets > 0 ? (double)res->total_bytes / res->total_packets
+                                : 0);
+  fflush(stdout);
+}
 
-  // クリーンアップ
-  free(data);
-  close(client_fd);
+// ストリームの結果を表示（複数ストリーム時は番号を付ける）
+static void print_stream_results(const struct stream_worker *w) {
+  char title[64];
+
+  if (w->cfg->num_streams > 1) {
+    snprintf(title, sizeof(title), "Transmission Results (stream %d)",
+             w->id + 1);
+  } else {
+    snprintf(title, sizeof(title), "Transmission Results");
+  }
+  print_results(&w->res, title);
+}
+
+// ストリームごとの送信スレッド本体
+// デーモンモードでは停止要求まで再接続を繰り返す
+static void *stream_main(void *arg) {
+  struct stream_worker *w = arg;
+  const struct client_config *cfg = w->cfg;
+  long long duration_us = cfg->duration_ms > 0
+                              ? cfg->duration_ms * 1000LL
+                              : cfg->test_duration * 1000000LL;
+  long long deadline = cfg->daemon_mode ? 0 : get_time_us() + duration_us;
+
+  while (!stop_requested) {
+    int client_fd = connect_to_server(cfg, w->id, 0);
+    if (client_fd < 0) {
+      if (!cfg->daemon_mode) {
+        w->status = 1;
+        break;
+      }
+      STATS_ADD(stats, errors_total, 1);
+      usleep(RECONNECT_INTERVAL_US);
+      continue;
+    }
+    __atomic_store_n(&w->fd, client_fd, __ATOMIC_RELEASE);
+
+    if (!cfg->quiet) {
+      if (cfg->num_streams > 1) {
+        printf("Stream %d connected to server\n", w->id + 1);
+      } else {
+        printf("Connected to server\n");
+      }
+    }
+    STATS_ADD(stats, connections_total, 1);
+    STATS_ADD(stats, connections_active, 1);
+
+    // 測定開始
+    run_transmission(cfg, client_fd, w->data, deadline, &w->res);
+
+    __atomic_store_n(&w->fd, -1, __ATOMIC_RELEASE);
+    close(client_fd);
+    STATS_ADD(stats, connections_active, -1);
+
+    if (!cfg->daemon_mode) {
+      break;
+    }
+
+    // デーモンモードでは接続ごとに結果を表示して再接続
+    print_stream_results(w);
+    if (!stop_requested) {
+      printf("Reconnecting...\n");
+      usleep(RECONNECT_INTERVAL_US);
+    }
+  }
+
+  __atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// 全ストリームを実行して終了を待ち、合計を total に返す
+static int run_streams(const struct client_config *cfg, char *data,
+                       struct stream_worker *workers,
+                       struct conn_result *total) {
+  // 送信スレッドを開始（シグナルはメインスレッドのみで受ける）
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int started = 0;
+  for (int i = 0; i < cfg->num_streams; i++) {
+    struct stream_worker *w = &workers[i];
+    memset(w, 0, sizeof(*w));
+    w->id = i;
+    w->cfg = cfg;
+    w->data = data;
+    w->fd = -1;
+    w->running = 1;
+    if (pthread_create(&w->thread, NULL, stream_main, w) != 0) {
+      fprintf(stderr, "Failed to create stream thread\n");
+      w->running = 0;
+      break;
+    }
+    started++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  // 全ストリームの終了を待つ
+  // 停止要求時はブロッキング中のsendをshutdownで中断させる
+  for (;;) {
+    int running = 0;
+    for (int i = 0; i < started; i++) {
+      running += __atomic_load_n(&workers[i].running, __ATOMIC_ACQUIRE);
+    }
+    if (running == 0) {
+      break;
+    }
+    if (stop_requested) {
+      for (int i = 0; i < started; i++) {
+        int fd = __atomic_load_n(&workers[i].fd, __ATOMIC_ACQUIRE);
+        if (fd >= 0) {
+          shutdown(fd, SHUT_RDWR);
+        }
+      }
+    }
+    usleep(100000);
+  }
+
+  // 結果の計算と表示
+  int status = started == cfg->num_streams ? 0 : 1;
+  memset(total, 0, sizeof(*total));
+  for (int i = 0; i < started; i++) {
+    struct stream_worker *w = &workers[i];
+    pthread_join(w->thread, NULL);
+    if (w->status != 0) {
+      status = 1;
+      continue;
+    }
+    if (!cfg->daemon_mode && !cfg->quiet) {
+      print_stream_results(w);
+    }
+    if (total->start_time == 0 || w->res.start_time < total->start_time) {
+      total->start_time = w->res.start_time;
+    }
+    if (w->res.end_time > total->end_time) {
+      total->end_time = w->res.end_time;
+    }
+    total->total_bytes += w->res.total_bytes;
+    total->total_packets += w->res.total_packets;
+  }
+
+  return status;
+}
+
+// 自動調整の目的関数
+enum tune_objective {
+  OBJECTIVE_GOODPUT,         // グッドプット最大
+  OBJECTIVE_GOODPUT_PER_CPU, // CPU秒あたりのグッドプット最大（送受信両側）
+};
+
+// 自動調整の探索方法
+enum tune_strategy {
+  STRATEGY_HILL_CLIMB, // 1軸ずつ隣の候補を試し、改善する方向へ進む
+  STRATEGY_HALVING,    // ランダムな候補を短時間試し、上位半分に倍の時間をかける
+};
+
+// 探索する設定（探索点は各軸の候補値のインデックスで表す）
+enum tune_param {
+  TUNE_SEND_SIZE,
+  TUNE_SNDBUF,
+  TUNE_RCVBUF, // サーバー側（制御チャネルが必要）
+  TUNE_STREAMS,
+  TUNE_TOKEN_BATCH, // サーバー側（制御チャネルが必要）
+  TUNE_NUM_PARAMS,
+};
+
+struct tune_axis {
+  const char *name;
+  const int *values; // 先頭が既定値（バッファサイズの0はカーネルの自動調整）
+  int nvalues;
+  int remote; // サーバー側の設定
+};
+
+static const int tune_send_sizes[] = {4096,   16384,   65536,
+                                      262144, 1048576, 4194304};
+static const int tune_buf_sizes[] = {0, 262144, 1048576, 4194304, 16777216};
+static const int tune_stream_counts[] = {1, 2, 4, 8, 16};
+static const int tune_token_batches[] = {1, 8, 32, 128};
+
+#define TUNE_AXIS(name, values, remote)                                        \
+  {name, values, sizeof(values) / sizeof(values[0]), remote}
+
+// 候補の最大値
+#define TUNE_LAST(values) (values[sizeof(values) / sizeof(values[0]) - 1])
+
+static const struct tune_axis tune_axes[TUNE_NUM_PARAMS] = {
+    [TUNE_SEND_SIZE] = TUNE_AXIS("send_size", tune_send_sizes, 0),
+    [TUNE_SNDBUF] = TUNE_AXIS("sndbuf", tune_buf_sizes, 0),
+    [TUNE_RCVBUF] = TUNE_AXIS("rcvbuf", tune_buf_sizes, 1),
+    [TUNE_STREAMS] = TUNE_AXIS("streams", tune_stream_counts, 0),
+    [TUNE_TOKEN_BATCH] = TUNE_AXIS("token_batch", tune_token_batches, 1),
+};
+
+// 1軸あたりの候補数の上限
+#define TUNE_MAX_VALUES 8
+
+// 改善とみなす最小の比率（測定のばらつきで探索が振動しないように）
+#define TUNE_MIN_GAIN 0.02
+#define TUNE_MAX_PROBES 256
+#define TUNE_MIN_PROBE_MS 250
+#define DEFAULT_PROBE_MS 2000
+#define DEFAULT_HILL_CLIMB_BUDGET 40 // 最大試行回数
+#define DEFAULT_HALVING_CANDIDATES 16
+
+// 自動調整の設定
+struct tune_config {
+  int enabled;
+  enum tune_objective objective;
+  enum tune_strategy strategy;
+  int probe_ms;    // 1回の試行時間（逐次半減法では最終段の1/4から開始）
+  int budget;      // 山登り: 最大試行回数, 逐次半減法: 初期候補数
+  int max_streams; // ストリーム数の上限
+};
+
+// 探索点と試行結果
+struct tune_point {
+  int idx[TUNE_NUM_PARAMS];
+  int valid;
+  double goodput_mbps;
+  double cpu_cores; // 平均使用コア数（制御チャネルがあればサーバー分も含む）
+  double score;
+};
+
+// 自動調整の状態
+struct tune_session {
+  const struct tune_config *tune;
+  const struct client_config *base;
+  char *data;
+  struct stream_worker *workers;
+  int ctrl_fd;                  // -1: 制御チャネルなし
+  int nvalues[TUNE_NUM_PARAMS]; // 探索する候補数（固定する軸は1）
+  // 探索する候補（実際に効く値が重複する候補は除く）と、その実際に効く値
+  // バッファサイズはカーネルが net.core.[rw]mem_max で黙って丸める
+  int values[TUNE_NUM_PARAMS][TUNE_MAX_VALUES];
+  int effective[TUNE_NUM_PARAMS][TUNE_MAX_VALUES];
+  int nprobes;
+};
+
+static int tune_value(const struct tune_session *sess,
+                      const struct tune_point *pt, enum tune_param p) {
+  return sess->values[p][pt->idx[p]];
+}
+
+static int tune_effective(const struct tune_session *sess,
+                          const struct tune_point *pt, enum tune_param p) {
+  return sess->effective[p][pt->idx[p]];
+}
+
+static const char *format_buf_size(int bytes, char *buf, size_t len) {
+  if (bytes == 0) {
+    snprintf(buf, len, "auto");
+  } else {
+    snprintf(buf, len, "%d", bytes);
+  }
+  return buf;
+}
+
+// 探索点を "send_size=65536 sndbuf=auto ..." 形式で表示
+static void print_tune_point(const struct tune_session *sess,
+                             const struct tune_point *pt) {
+  char buf[32];
+
+  for (int p = 0; p < TUNE_NUM_PARAMS; p++) {
+    if (tune_axes[p].remote && sess->ctrl_fd < 0) {
+      continue;
+    }
+    if (p == TUNE_SNDBUF || p == TUNE_RCVBUF) {
+      format_buf_size(tune_value(sess, pt, p), buf, sizeof(buf));
+    } else {
+      snprintf(buf, sizeof(buf), "%d", tune_value(sess, pt, p));
+    }
+    printf("%s%s=%s", p == 0 ? "" : " ", tune_axes[p].name, buf);
+    if (tune_effective(sess, pt, p) != tune_value(sess, pt, p)) {
+      printf("(eff %d)", tune_effective(sess, pt, p));
+    }
+  }
+}
+
+static long long rusage_total_us(const struct rusage *ru) {
+  return ru->ru_utime.tv_sec * 1000000LL + ru->ru_utime.tv_usec +
+         ru->ru_stime.tv_sec * 1000000LL + ru->ru_stime.tv_usec;
+}
+
+// 1つの探索点を duration_ms だけ試行して評価
+static void tune_probe(struct tune_session *sess, struct tune_point *pt,
+                       int duration_ms) {
+  struct client_config cfg = *sess->base;
+  struct devmem_control_stats srv_start, srv_end;
+  struct rusage ru_start, ru_end;
+  struct conn_result total;
+  long long server_cpu_us = 0;
+  uint64_t goodput_bytes;
+
+  cfg.data_size = tune_value(sess, pt, TUNE_SEND_SIZE);
+  cfg.sndbuf = tune_value(sess, pt, TUNE_SNDBUF);
+  cfg.num_streams = tune_value(sess, pt, TUNE_STREAMS);
+  cfg.duration_ms = duration_ms;
+  cfg.quiet = 1;
+
+  pt->valid = 0;
+  pt->goodput_mbps = pt->cpu_cores = pt->score = 0;
+  sess->nprobes++;
+
+  printf("Probe %3d: ", sess->nprobes);
+  print_tune_point(sess, pt);
+  fflush(stdout);
+
+  if (sess->ctrl_fd >= 0 &&
+      (devmem_control_set(sess->ctrl_fd, "rcvbuf",
+                          tune_value(sess, pt, TUNE_RCVBUF)) < 0 ||
+       devmem_control_set(sess->ctrl_fd, "token_batch",
+                          tune_value(sess, pt, TUNE_TOKEN_BATCH)) < 0 ||
+       devmem_control_get_stats(sess->ctrl_fd, &srv_start) < 0)) {
+    printf(" -> control channel failed\n");
+    return;
+  }
+
+  getrusage(RUSAGE_SELF, &ru_start);
+  int status = run_streams(&cfg, sess->data, sess->workers, &total);
+  getrusage(RUSAGE_SELF, &ru_end);
+
+  if (sess->ctrl_fd >= 0) {
+    if (devmem_control_get_stats(sess->ctrl_fd, &srv_end) < 0) {
+      printf(" -> control channel failed\n");
+      return;
+    }
+    server_cpu_us = srv_end.cpu_us - srv_start.cpu_us;
+  }
+
+  double duration_us = total.end_time - total.start_time;
+  if (status != 0 || stop_requested || total.total_bytes == 0 ||
+      duration_us <= 0) {
+    printf(" -> failed\n");
+    return;
+  }
+
+  // 制御チャネルがあればサーバーが受信したバイト数で評価する
+  // （クライアントの送信バイト数は送信バッファに積んだだけの分を含み、
+  //   短い試行では大きなsndbufや多いストリーム数を過大評価する）
+  goodput_bytes = sess->ctrl_fd >= 0 ? srv_end.bytes - srv_start.bytes
+                                     : (uint64_t)total.total_bytes;
+  long long cpu_us =
+      rusage_total_us(&ru_end) - rusage_total_us(&ru_start) + server_cpu_us;
+  pt->goodput_mbps =
+      goodput_bytes / (duration_us / 1000000.0) / 1024.0 / 1024.0 * 8.0;
+  pt->cpu_cores = cpu_us / duration_us;
+  if (sess->tune->objective == OBJECTIVE_GOODPUT) {
+    pt->score = pt->goodput_mbps;
+  } else {
+    pt->score = pt->cpu_cores > 0 ? pt->goodput_mbps / pt->cpu_cores : 0;
+  }
+  pt->valid = 1;
+
+  printf(" -> %.2f Mbps, %.2f cores, %.1f Mb/CPU-s\n", pt->goodput_mbps,
+         pt->cpu_cores,
+         pt->cpu_cores > 0 ? pt->goodput_mbps / pt->cpu_cores : 0);
+  fflush(stdout);
+}
+
+static int same_point(const struct tune_point *a, const struct tune_point *b) {
+  return memcmp(a->idx, b->idx, sizeof(a->idx)) == 0;
+}
+
+// 山登り法: 1軸ずつ隣の候補を試し、改善が続く限り同じ方向へ進む
+// 全軸で改善が無くなるか試行回数が上限に達したら終了
+static void tune_hill_climb(struct tune_session *sess,
+                            struct tune_point *best) {
+  static struct tune_point tried[TUNE_MAX_PROBES];
+  int ntried = 0;
+  int budget = sess->tune->budget;
+
+  tune_probe(sess, best, sess->tune->probe_ms);
+  tried[ntried++] = *best;
+
+  int improved = 1;
+  while (improved && !stop_requested && sess->nprobes < budget) {
+    improved = 0;
+    for (int p = 0; p < TUNE_NUM_PARAMS; p++) {
+      for (int dir = -1; dir <= 1; dir += 2) {
+        while (!stop_requested && sess->nprobes < budget) {
+          struct tune_point next = *best;
+          next.idx[p] += dir;
+          if (next.idx[p] < 0 || next.idx[p] >= sess->nvalues[p]) {
+            break;
+          }
+
+          // 試行済みの点は再測定しない
+          int i;
+          for (i = 0; i < ntried; i++) {
+            if (same_point(&tried[i], &next)) {
+              next = tried[i];
+              break;
+            }
+          }
+          if (i == ntried) {
+            tune_probe(sess, &next, sess->tune->probe_ms);
+            tried[ntried++] = next;
+          }
+
+          if (!next.valid || next.score <= best->score * (1 + TUNE_MIN_GAIN)) {
+            break;
+          }
+          *best = next;
+          improved = 1;
+        }
+      }
+    }
+  }
+}
+
+static int compare_score_desc(const void *a, const void *b) {
+  const struct tune_point *pa = a, *pb = b;
+  return (pa->score < pb->score) - (pa->score > pb->score);
+}
+
+// 逐次半減法: ランダムな候補を短時間ずつ試し、上位半分を残して
+// 試行時間を倍にしながら1つに絞る
+static void tune_successive_halving(struct tune_session *sess,
+                                    struct tune_point *best) {
+  static struct tune_point cand[TUNE_MAX_PROBES];
+  int n = 0;
+  uint64_t draw = 0;
+
+  // 開始点と、重複しないランダムな探索点（乱数はパターン生成器を流用）
+  cand[n++] = *best;
+  for (int attempt = 0;
+       n < sess->tune->budget && attempt < sess->tune->budget * 16;
+       attempt++) {
+    struct tune_point pt;
+    memset(&pt, 0, sizeof(pt));
+    for (int p = 0; p < TUNE_NUM_PARAMS; p++) {
+      uint64_t r = test_pattern_word(PATTERN_INCOMPRESSIBLE, sess->base->seed,
+                                     draw++);
+      pt.idx[p] = r % sess->nvalues[p];
+    }
+    int dup = 0;
+    for (int i = 0; i < n && !dup; i++) {
+      dup = same_point(&cand[i], &pt);
+    }
+    if (!dup) {
+      cand[n++] = pt;
+    }
+  }
+
+  int duration_ms = sess->tune->probe_ms / 4;
+  if (duration_ms < TUNE_MIN_PROBE_MS) {
+    duration_ms = TUNE_MIN_PROBE_MS;
+  }
+
+  for (int round = 1; n > 1 && !stop_requested; round++) {
+    printf("Round %d: %d candidates, %d ms each\n", round, n, duration_ms);
+    for (int i = 0; i < n && !stop_requested; i++) {
+      tune_probe(sess, &cand[i], duration_ms);
+    }
+    qsort(cand, n, sizeof(cand[0]), compare_score_desc);
+    n = (n + 1) / 2;
+    duration_ms *= 2;
+  }
+
+  *best = cand[0];
+}
+
+// SO_SNDBUF に bytes を設定したときに実際に効くサイズ（作業用ソケットで確かめる）
+static int effective_sndbuf(int bytes) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return bytes;
+  }
+  int effective = devmem_set_buffer_size(fd, SO_SNDBUF, bytes);
+  close(fd);
+  return effective < 0 ? bytes : effective;
+}
+
+// 1軸の候補を準備する
+// バッファサイズは実際に効く値を調べ、既に候補にある値と同じになるものは除く
+// （上限で丸められた 4MB と 16MB を別々に試しても同じ設定を測るだけ）
+static int init_tune_axis(struct tune_session *sess, enum tune_param p) {
+  const struct tune_axis *axis = &tune_axes[p];
+  int n = 0;
+
+  for (int i = 0; i < axis->nvalues && n < TUNE_MAX_VALUES; i++) {
+    int value = axis->values[i];
+    long long effective = value;
+
+    if (value > 0 && p == TUNE_SNDBUF) {
+      effective = effective_sndbuf(value);
+    } else if (value > 0 && p == TUNE_RCVBUF && sess->ctrl_fd >= 0) {
+      effective = devmem_control_set(sess->ctrl_fd, "rcvbuf", value);
+      if (effective < 0) {
+        return -1;
+      }
+    }
+
+    int dup = -1;
+    for (int j = 0; j < n && value > 0; j++) {
+      if (sess->values[p][j] > 0 && sess->effective[p][j] == effective) {
+        dup = j;
+      }
+    }
+    if (dup >= 0) {
+      printf("Skipping %s=%d: effective size %lld is the same as %s=%d\n",
+             axis->name, value, effective, axis->name, sess->values[p][dup]);
+      continue;
+    }
+    sess->values[p][n] = value;
+    sess->effective[p][n] = (int)effective;
+    n++;
+  }
+  sess->nvalues[p] = n;
+
+  // 調べるために変えたサーバーの設定を既定に戻す
+  if (p == TUNE_RCVBUF && sess->ctrl_fd >= 0 &&
+      devmem_control_set(sess->ctrl_fd, "rcvbuf", 0) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// 送信サイズ・ソケットバッファ・ストリーム数・トークン返却バッチを自動調整し、
+// 最良の設定を表示する
+static int autotune(const struct tune_config *tune,
+                    const struct client_config *cfg, char *data,
+                    struct stream_worker *workers) {
+  struct tune_session sess;
+  struct tune_point best;
+
+  memset(&sess, 0, sizeof(sess));
+  sess.tune = tune;
+  sess.base = cfg;
+  sess.data = data;
+  sess.workers = workers;
+  sess.ctrl_fd = -1;
+
+  if (cfg->control_port > 0) {
+    sess.ctrl_fd = devmem_control_connect(cfg->server_ip, cfg->control_port);
+    if (sess.ctrl_fd < 0) {
+      fprintf(stderr, "Cannot connect to control port %d\n",
+              cfg->control_port);
+      return 1;
+    }
+  } else {
+    printf("No control port: rcvbuf/token_batch are not searched and CPU "
+           "cost is client-side only\n");
+  }
+
+  // 探索範囲（サーバー側の設定は制御チャネルが無ければ既定値に固定）
+  for (int p = 0; p < TUNE_NUM_PARAMS; p++) {
+    if (init_tune_axis(&sess, p) < 0) {
+      fprintf(stderr, "Control channel failed\n");
+      close(sess.ctrl_fd);
+      return 1;
+    }
+    if (tune_axes[p].remote && sess.ctrl_fd < 0) {
+      sess.nvalues[p] = 1;
+    }
+  }
+  while (sess.nvalues[TUNE_STREAMS] > 1 &&
+         sess.values[TUNE_STREAMS][sess.nvalues[TUNE_STREAMS] - 1] >
+             tune->max_streams) {
+    sess.nvalues[TUNE_STREAMS]--;
+  }
+
+  // 開始点: 指定された送信サイズに最も近い候補、その他は既定値
+  memset(&best, 0, sizeof(best));
+  for (int i = 0; i < sess.nvalues[TUNE_SEND_SIZE]; i++) {
+    if (sess.values[TUNE_SEND_SIZE][i] <= cfg->data_size) {
+      best.idx[TUNE_SEND_SIZE] = i;
+    }
+  }
+
+  printf("\n=== Autotune (%s, objective %s) ===\n",
+         tune->strategy == STRATEGY_HILL_CLIMB ? "hill climbing"
+                                               : "successive halving",
+         tune->objective == OBJECTIVE_GOODPUT ? "goodput" : "goodput per CPU");
+  if (sess.ctrl_fd >= 0) {
+    printf("Goodput basis: bytes received by the server\n");
+  } else {
+    printf("Goodput basis: bytes sent by the client (no --control-port; "
+           "includes data still in socket buffers)\n");
+  }
+
+  if (tune->strategy == STRATEGY_HILL_CLIMB) {
+    tune_hill_climb(&sess, &best);
+  } else {
+    tune_successive_halving(&sess, &best);
+  }
+
+  printf("\n=== Autotune Result ===\n");
+  printf("Probes: %d\n", sess.nprobes);
+  if (!best.valid) {
+    printf("No successful probe\n");
+    if (sess.ctrl_fd >= 0) {
+      close(sess.ctrl_fd);
+    }
+    return 1;
+  }
+
+  char rcvbuf[32];
+  printf("Best: ");
+  print_tune_point(&sess, &best);
+  printf("\n");
+  printf("Goodput: %.2f Mbps\n", best.goodput_mbps);
+  printf("CPU: %.2f cores (%.1f Mb/CPU-s)\n", best.cpu_cores,
+         best.cpu_cores > 0 ? best.goodput_mbps / best.cpu_cores : 0);
+  printf("Client: --streams %d --sndbuf %d <server_ip> <port> %d\n",
+         tune_value(&sess, &best, TUNE_STREAMS),
+         tune_value(&sess, &best, TUNE_SNDBUF),
+         tune_value(&sess, &best, TUNE_SEND_SIZE));
+  if (tune_effective(&sess, &best, TUNE_SNDBUF) !=
+      tune_value(&sess, &best, TUNE_SNDBUF)) {
+    printf("Effective SO_SNDBUF: %d (clamped by net.core.wmem_max)\n",
+           tune_effective(&sess, &best, TUNE_SNDBUF));
+  }
+
+  // 最良のサーバー側設定を適用したままにする
+  if (sess.ctrl_fd >= 0) {
+    printf("Server: --rcvbuf %d --token-batch %d\n",
+           tune_value(&sess, &best, TUNE_RCVBUF),
+           tune_value(&sess, &best, TUNE_TOKEN_BATCH));
+    long long applied = devmem_control_set(
+        sess.ctrl_fd, "rcvbuf", tune_value(&sess, &best, TUNE_RCVBUF));
+    if (applied >= 0 &&
+        devmem_control_set(sess.ctrl_fd, "token_batch",
+                           tune_value(&sess, &best, TUNE_TOKEN_BATCH)) >= 0) {
+      printf("Applied rcvbuf=%s token_batch=%d to the server\n",
+             format_buf_size((int)applied, rcvbuf, sizeof(rcvbuf)),
+             tune_value(&sess, &best, TUNE_TOKEN_BATCH));
+    }
+    close(sess.ctrl_fd);
+  }
+  fflush(stdout);
 
   return 0;
-}
\ No newline at end of file
+}
+
+// 混合ワークロード: 1フローの結果
+struct flow_result {
+  long long messages;
+  long long bytes;
+  long long start_time;
+  long long end_time;
+  long long untracked; // 応答待ちが溢れて応答時間を測れなかったメッセージ数
+  struct latency_hist latency; // 予定送信時刻から応答受信までの時間
+};
+
+// 混合ワークロードの1フロー
+struct flow_worker {
+  pthread_t thread;
+  int id; // 全フローの通し番号（送信元アドレスの選択に使う）
+  const struct client_config *cfg;
+  const struct flow_class *cls;
+  int latency; // 制御チャネルがあり、応答時間を測るフロー
+  char *data;
+  int fd;
+  int status;
+  int running;
+  struct flow_result res;
+};
+
+// 応答待ちのメッセージ（リングバッファ）
+#define MAX_PENDING_MSGS 65536
+
+// 送信終了後に残りの応答を待つ時間
+#define ACK_DRAIN_TIMEOUT_NS 1000000000LL
+
+struct pending_msg {
+  long long end_offset; // メッセージ末尾の累積送信バイト数
+  long long sched_ns;   // 予定送信時刻
+};
+
+struct flow_state {
+  struct pending_msg *pending;
+  unsigned head, tail;
+  unsigned char ack_buf[8];
+  int ack_have;
+};
+
+// 届いている応答を読み、累積受信バイト数までのメッセージの応答時間を記録
+// 相手が接続を閉じた場合は-1
+static int process_acks(int fd, struct flow_state *st,
+                        struct flow_result *res) {
+  for (;;) {
+    ssize_t n = recv(fd, st->ack_buf + st->ack_have,
+                     sizeof(st->ack_buf) - st->ack_have, MSG_DONTWAIT);
+    if (n == 0) {
+      return -1;
+    }
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return 0;
+      }
+      return -1;
+    }
+    st->ack_have += n;
+    if (st->ack_have < (int)sizeof(st->ack_buf)) {
+      continue;
+    }
+    st->ack_have = 0;
+
+    uint64_t acked;
+    memcpy(&acked, st->ack_buf, sizeof(acked));
+    acked = be64toh(acked);
+
+    long long now = get_time_ns();
+    while (st->head != st->tail &&
+           (uint64_t)st->pending[st->head % MAX_PENDING_MSGS].end_offset <=
+               acked) {
+      latency_hist_add(&res->latency,
+                       now - st->pending[st->head % MAX_PENDING_MSGS].sched_ns);
+      st->head++;
+    }
+  }
+}
+
+// until_ns まで応答を処理しながら待つ
+// 相手が接続を閉じた・エラーになった場合は-1（待ち続けると空回りするため）
+static int wait_until(int fd, struct flow_state *st, struct flow_result *res,
+                      int latency, long long until_ns) {
+  for (;;) {
+    long long now = get_time_ns();
+    if (now >= until_ns || stop_requested) {
+      return 0;
+    }
+    struct timespec ts = {.tv_sec = (until_ns - now) / 1000000000LL,
+                          .tv_nsec = (until_ns - now) % 1000000000LL};
+    if (!latency) {
+      nanosleep(&ts, NULL);
+      continue;
+    }
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (ppoll(&pfd, 1, &ts, NULL) > 0) {
+      if (pfd.revents & (POLLERR | POLLHUP)) {
+        return -1;
+      }
+      if (process_acks(fd, st, res) < 0) {
+        return -1;
+      }
+    }
+  }
+}
+
+// 1フロー分の送信ループ
+// レート指定時は予定時刻に従って送り（オープンループ）、応答時間は予定時刻から
+// 測るため、送信が遅れた分も応答時間に含まれる（coordinated omissionを避ける）
+static void run_flow(const struct flow_worker *w, int fd, long long deadline,
+                     struct flow_result *res) {
+  const struct flow_class *cls = w->cls;
+  struct flow_state st;
+  uint64_t rng = w->cfg->seed * 0x9e3779b97f4a7c15ULL + w->id;
+  long long interval_ns = cls->rate > 0 ? (long long)(1e9 / cls->rate) : 0;
+  long long on_ns = cls->on_ms * 1000000LL;
+  long long period_ns = (cls->on_ms + cls->off_ms) * 1000000LL;
+  long long deadline_ns;
+
+  memset(res, 0, sizeof(*res));
+  memset(&st, 0, sizeof(st));
+  if (w->latency) {
+    st.pending = malloc(sizeof(*st.pending) * MAX_PENDING_MSGS);
+    if (!st.pending) {
+      perror("malloc failed");
+      return;
+    }
+  }
+
+  res->start_time = get_time_us();
+  long long start_ns = get_time_ns();
+  long long next_ns = start_ns;
+  deadline_ns = start_ns + (deadline - res->start_time) * 1000LL;
+
+  while (!stop_requested && get_time_ns() < deadline_ns) {
+    long long now = get_time_ns();
+    long long sched;
+
+    // バースト: オフ期間は次のオン期間まで待ち、オフ中の予定分は送らない
+    if (period_ns > 0) {
+      long long phase = (now - start_ns) % period_ns;
+      if (phase >= on_ns) {
+        long long wake = now + period_ns - phase;
+        if (wait_until(fd, &st, res, w->latency,
+                       wake < deadline_ns ? wake : deadline_ns) < 0) {
+          goto closed;
+        }
+        next_ns = wake;
+        continue;
+      }
+    }
+
+    if (interval_ns > 0) {
+      if (now < next_ns) {
+        if (wait_until(fd, &st, res, w->latency,
+                       next_ns < deadline_ns ? next_ns : deadline_ns) < 0) {
+          goto closed;
+        }
+        continue;
+      }
+      sched = next_ns;
+      next_ns += interval_ns;
+    } else {
+      sched = now;
+    }
+
+    // 1メッセージを送信（部分送信は続きから送る）
+    int size = flow_class_sample_size(cls, &rng);
+    int sent = 0;
+    while (sent < size && !stop_requested) {
+      ssize_t n = send(fd, w->data + sent, size - sent, 0);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("send failed");
+        STATS_ADD(stats, errors_total, 1);
+        goto out;
+      }
+      sent += n;
+      res->bytes += n;
+      STATS_ADD(stats, bytes_total, n);
+    }
+    if (sent < size) {
+      break;
+    }
+    res->messages++;
+    STATS_ADD(stats, packets_total, 1);
+
+    if (w->latency) {
+      if (st.tail - st.head < MAX_PENDING_MSGS) {
+        st.pending[st.tail % MAX_PENDING_MSGS].end_offset = res->bytes;
+        st.pending[st.tail % MAX_PENDING_MSGS].sched_ns = sched;
+        st.tail++;
+      } else {
+        res->untracked++;
+      }
+      if (process_acks(fd, &st, res) < 0) {
+        goto closed;
+      }
+    }
+  }
+
+  // 送信済みメッセージの応答を待つ
+  if (w->latency) {
+    long long drain_until = get_time_ns() + ACK_DRAIN_TIMEOUT_NS;
+    while (st.head != st.tail && !stop_requested &&
+           get_time_ns() < drain_until) {
+      if (wait_until(fd, &st, res, 1, get_time_ns() + 1000000) < 0) {
+        goto closed;
+      }
+    }
+    res->untracked += st.tail - st.head;
+  }
+  goto out;
+
+closed:
+  // 接続が切れたフローは打ち切り、応答のないメッセージは未追跡として数える
+  fprintf(stderr, "Flow %d: connection closed by server\n", w->id);
+  STATS_ADD(stats, errors_total, 1);
+  res->untracked += st.tail - st.head;
+
+out:
+  res->end_time = get_time_us();
+  free(st.pending);
+}
+
+// フローごとの送信スレッド本体
+static void *flow_main(void *arg) {
+  struct flow_worker *w = arg;
+  const struct client_config *cfg = w->cfg;
+  long long deadline = get_time_us() + cfg->test_duration * 1000000LL;
+
+  int client_fd = connect_to_server(cfg, w->id, w->latency);
+  if (client_fd < 0) {
+    w->status = 1;
+    __atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+    return NULL;
+  }
+  __atomic_store_n(&w->fd, client_fd, __ATOMIC_RELEASE);
+  STATS_ADD(stats, connections_total, 1);
+  STATS_ADD(stats, connections_active, 1);
+
+  run_flow(w, client_fd, deadline, &w->res);
+
+  __atomic_store_n(&w->fd, -1, __ATOMIC_RELEASE);
+  close(client_fd);
+  STATS_ADD(stats, connections_active, -1);
+  __atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// フロークラスごとの結果を表示
+static void print_class_results(const struct flow_class *cls,
+                                const struct flow_worker *workers, int nflows) {
+  struct flow_result total;
+  int failed = 0;
+
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < nflows; i++) {
+    const struct flow_result *r = &workers[i].res;
+    if (workers[i].status != 0) {
+      failed++;
+      continue;
+    }
+    if (total.start_time == 0 || r->start_time < total.start_time) {
+      total.start_time = r->start_time;
+    }
+    if (r->end_time > total.end_time) {
+      total.end_time = r->end_time;
+    }
+    total.messages += r->messages;
+    total.bytes += r->bytes;
+    total.untracked += r->untracked;
+    latency_hist_merge(&total.latency, &r->latency);
+  }
+
+  double duration = (total.end_time - total.start_time) / 1000000.0;
+  if (duration <= 0) {
+    duration = 1;
+  }
+
+  printf("\n=== Class %s (%d flows%s) ===\n", cls->name, cls->flows,
+         failed ? ", some failed to connect" : "");
+  printf("Messages: %lld (%.1f msgs/sec)\n", total.messages,
+         total.messages / duration);
+  printf("Total bytes sent: %lld bytes\n", total.bytes);
+  printf("Goodput: %.2f Mbps\n", total.bytes / duration / 1024.0 / 1024.0 * 8.0);
+  if (workers[0].latency) {
+    const struct latency_hist *h = &total.latency;
+    printf("Message latency: avg %.2f us, p50 %.2f us, p99 %.2f us, "
+           "p99.9 %.2f us, max %.2f us (%lld samples",
+           h->count > 0 ? (double)h->sum_ns / h->count / 1000.0 : 0,
+           latency_hist_percentile(h, 50) / 1000.0,
+           latency_hist_percentile(h, 99) / 1000.0,
+           latency_hist_percentile(h, 99.9) / 1000.0, h->max_ns / 1000.0,
+           h->count);
+    if (total.untracked > 0) {
+      printf(", %lld untracked", total.untracked);
+    }
+    printf(")\n");
+  }
+}
+
+// 混合ワークロードを実行し、クラスごとの結果を表示
+static int run_workload(const struct client_config *cfg,
+                        const struct workload *wl, char *data,
+                        struct flow_worker *workers) {
+  int nflows = 0;
+
+  if (cfg->control_port > 0) {
+    control.fd = devmem_control_connect(cfg->server_ip, cfg->control_port);
+    if (control.fd < 0) {
+      fprintf(stderr, "Cannot connect to control port %d\n",
+              cfg->control_port);
+      return 1;
+    }
+  } else {
+    printf("No control port: message latency is not measured\n");
+  }
+
+  // 送信スレッドを開始（シグナルはメインスレッドのみで受ける）
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (int c = 0; c < wl->nclasses; c++) {
+    for (int i = 0; i < wl->classes[c].flows; i++) {
+      struct flow_worker *w = &workers[nflows];
+      memset(w, 0, sizeof(*w));
+      w->id = nflows;
+      w->cfg = cfg;
+      w->cls = &wl->classes[c];
+      w->latency = w->cls->latency && control.fd >= 0;
+      w->data = data;
+      w->fd = -1;
+      w->running = 1;
+      if (pthread_create(&w->thread, NULL, flow_main, w) != 0) {
+        fprintf(stderr, "Failed to create flow thread\n");
+        w->running = 0;
+        break;
+      }
+      nflows++;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  // 全フローの終了を待つ（停止要求時はshutdownで中断させる）
+  for (;;) {
+    int running = 0;
+    for (int i = 0; i < nflows; i++) {
+      running += __atomic_load_n(&workers[i].running, __ATOMIC_ACQUIRE);
+    }
+    if (running == 0) {
+      break;
+    }
+    if (stop_requested) {
+      for (int i = 0; i < nflows; i++) {
+        int fd = __atomic_load_n(&workers[i].fd, __ATOMIC_ACQUIRE);
+        if (fd >= 0) {
+          shutdown(fd, SHUT_RDWR);
+        }
+      }
+    }
+    usleep(100000);
+  }
+
+  int status = nflows == wl->total_flows ? 0 : 1;
+  long long total_bytes = 0, start = 0, end = 0;
+  for (int i = 0; i < nflows; i++) {
+    pthread_join(workers[i].thread, NULL);
+    if (workers[i].status != 0) {
+      status = 1;
+      continue;
+    }
+    total_bytes += workers[i].res.bytes;
+    if (start == 0 || workers[i].res.start_time < start) {
+      start = workers[i].res.start_time;
+    }
+    if (workers[i].res.end_time > end) {
+      end = workers[i].res.end_time;
+    }
+  }
+
+  // クラスごとの結果（フローはクラス順に並んでいる）
+  int first = 0;
+  for (int c = 0; c < wl->nclasses && first < nflows; c++) {
+    int n = wl->classes[c].flows;
+    if (first + n > nflows) {
+      n = nflows - first;
+    }
+    print_class_results(&wl->classes[c], &workers[first], n);
+    first += n;
+  }
+
+  if (end > start) {
+    printf("\n=== Workload Total (%d flows) ===\n", nflows);
+    printf("Total bytes sent: %lld bytes\n", total_bytes);
+    printf("Goodput: %.2f Mbps\n",
+           total_bytes / ((end - start) / 1000000.0) / 1024.0 / 1024.0 * 8.0);
+  }
+  fflush(stdout);
+
+  if (control.fd >= 0) {
+    close(control.fd);
+    control.fd = -1;
+  }
+  return status;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [options] [server_ip] [port] [data_size] [duration_sec] "
+          "[use_devmem] [interface]\n"
+          "  -D, --daemon             send until SIGTERM, reconnecting on "
+          "disconnect\n"
+          "  -m, --metrics-port PORT  Prometheus endpoint on 127.0.0.1 "
+          "(default %d in daemon mode, 0 disables)\n"
+          "  -s, --shm NAME           shared memory segment for counters "
+          "(daemon mode default %s.<pid>,\n"
+          "                           \"\" disables; otherwise none)\n"
+          "  -P, --streams N          parallel streams (default 1, max %d)\n"
+          "  -L, --local LIST         comma-separated source addresses "
+          "(addr, addr:port, [v6addr]:port);\n"
+          "                           streams are spread round-robin, the port "
+          "advances each round\n"
+          "  -p, --pattern NAME       increment | prng | incompressible "
+          "(default increment)\n"
+          "  -S, --seed N             seed for prng/incompressible "
+          "(default 1)\n"
+          "  -T, --fill-threads N     buffer initialization threads "
+          "(default: auto)\n"
+          "  -b, --sndbuf BYTES       SO_SNDBUF per stream "
+          "(default 0: kernel autotuning)\n"
+          "  -A, --autotune           search send size, SO_SNDBUF, streams "
+          "and (with -c) server\n"
+          "                           SO_RCVBUF/token batch with short "
+          "probes; --streams is the upper bound\n"
+          "  -o, --objective NAME     goodput | goodput-per-cpu "
+          "(default goodput)\n"
+          "  -t, --tune-strategy NAME hill | halving (default hill)\n"
+          "  -c, --control-port PORT  server control port "
+          "(devmem_server --control-port);\n"
+          "                           used by --autotune and for --workload "
+          "message latency\n"
+          "  -d, --probe-ms N         probe length (default %d)\n"
+          "  -n, --tune-budget N      hill: max probes (default %d), "
+          "halving: candidates (default %d)\n"
+          "  -W, --workload FILE      run the flow classes in FILE "
+          "concurrently (see devmem_workload.h)\n"
+          "  -K, --trace              run bpftrace probes on the zerocopy, "
+          "receive and page_pool\n"
+          "                           paths and append the histograms to the "
+          "report (needs root)\n",
+          prog, DEFAULT_METRICS_PORT, DEFAULT_SHM_PREFIX, MAX_STREAMS,
+          DEFAULT_PROBE_MS, DEFAULT_HILL_CLIMB_BUDGET,
+          DEFAULT_HALVING_CANDIDATES);
+}
+
+// グッドプット測定クライアント
+int main(int argc, char *argv[]) {
+  static struct client_config cfg = {
+      .server_ip = "127.0.0.1",
+      .port = 5201,
+      .data_size = 1024 * 1024, // 1MB per send
+      .test_duration = 10,
+      .use_devmem = 0,
+      .interface_name = "eth1", // デフォルトのインターフェース名
+      .daemon_mode = 0,
+      .metrics_port = -1,
+      .shm_name = NULL,
+      .num_streams = 1,
+      .pattern = PATTERN_INCREMENT,
+      .seed = 1,
+      .fill_threads = 0,
+      .sndbuf = 0,
+      .control_port = 0,
+  };
+  struct tune_config tune = {
+      .enabled = 0,
+      .objective = OBJECTIVE_GOODPUT,
+      .strategy = STRATEGY_HILL_CLIMB,
+      .probe_ms = DEFAULT_PROBE_MS,
+      .budget = 0,
+      .max_streams = 0,
+  };
+  static struct stream_worker workers[MAX_STREAMS];
+  static struct flow_worker flow_workers[MAX_STREAMS];
+  static struct workload workload;
+  const char *workload_path = NULL;
+  int trace_enabled = 0;
+  struct devmem_trace trace = {.pid = -1, .fd = -1};
+  struct devmem_metrics_server metrics;
+  static const struct option long_options[] = {
+      {"daemon", no_argument, NULL, 'D'},
+      {"metrics-port", required_argument, NULL, 'm'},
+      {"shm", required_argument, NULL, 's'},
+      {"streams", required_argument, NULL, 'P'},
+      {"local", required_argument, NULL, 'L'},
+      {"pattern", required_argument, NULL, 'p'},
+      {"seed", required_argument, NULL, 'S'},
+      {"fill-threads", required_argument, NULL, 'T'},
+      {"sndbuf", required_argument, NULL, 'b'},
+      {"autotune", no_argument, NULL, 'A'},
+      {"objective", required_argument, NULL, 'o'},
+      {"tune-strategy", required_argument, NULL, 't'},
+      {"control-port", required_argument, NULL, 'c'},
+      {"probe-ms", required_argument, NULL, 'd'},
+      {"tune-budget", required_argument, NULL, 'n'},
+      {"workload", required_argument, NULL, 'W'},
+      {"trace", no_argument, NULL, 'K'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "Dm:s:P:L:p:S:T:b:Ao:t:c:d:n:W:Kh",
+                            long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'D':
+      cfg.daemon_mode = 1;
+      break;
+    case 'm':
+      cfg.metrics_port = atoi(optarg);
+      break;
+    case 's':
+      cfg.shm_name = optarg;
+      break;
+    case 'P':
+      cfg.num_streams = atoi(optarg);
+      if (cfg.num_streams < 1 || cfg.num_streams > MAX_STREAMS) {
+        fprintf(stderr, "Invalid stream count: %s\n", optarg);
+        return 1;
+      }
+      tune.max_streams = cfg.num_streams;
+      break;
+    case 'L':
+      if (parse_local_addrs(optarg, &cfg) < 0) {
+        return 1;
+      }
+      break;
+    case 'p':
+      if (test_pattern_parse(optarg, &cfg.pattern) < 0) {
+        fprintf(stderr, "Unknown pattern: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'S':
+      cfg.seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'T':
+      cfg.fill_threads = atoi(optarg);
+      break;
+    case 'b':
+      cfg.sndbuf = atoi(optarg);
+      break;
+    case 'A':
+      tune.enabled = 1;
+      break;
+    case 'o':
+      if (strcmp(optarg, "goodput") == 0) {
+        tune.objective = OBJECTIVE_GOODPUT;
+      } else if (strcmp(optarg, "goodput-per-cpu") == 0) {
+        tune.objective = OBJECTIVE_GOODPUT_PER_CPU;
+      } else {
+        fprintf(stderr, "Unknown objective: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 't':
+      if (strcmp(optarg, "hill") == 0) {
+        tune.strategy = STRATEGY_HILL_CLIMB;
+      } else if (strcmp(optarg, "halving") == 0) {
+        tune.strategy = STRATEGY_HALVING;
+      } else {
+        fprintf(stderr, "Unknown tune strategy: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'c':
+      cfg.control_port = atoi(optarg);
+      break;
+    case 'd':
+      tune.probe_ms = atoi(optarg);
+      if (tune.probe_ms < TUNE_MIN_PROBE_MS) {
+        fprintf(stderr, "Probe length must be at least %d ms\n",
+                TUNE_MIN_PROBE_MS);
+        return 1;
+      }
+      break;
+    case 'n':
+      tune.budget = atoi(optarg);
+      if (tune.budget < 1 || tune.budget > TUNE_MAX_PROBES) {
+        fprintf(stderr, "Invalid tune budget: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'W':
+      workload_path = optarg;
+      break;
+    case 'K':
+      trace_enabled = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  // 従来どおりの位置引数
+  if (optind < argc) {
+    cfg.server_ip = argv[optind++];
+  }
+  if (optind < argc) {
+    cfg.port = atoi(argv[optind++]);
+  }
+  if (optind < argc) {
+    cfg.data_size = atoi(argv[optind++]);
+  }
+  if (optind < argc) {
+    cfg.test_duration = atoi(argv[optind++]);
+  }
+  if (optind < argc) {
+    cfg.use_devmem = atoi(argv[optind++]);
+  }
+  if (optind < argc) {
+    cfg.interface_name = argv[optind++];
+  }
+  if (cfg.metrics_port < 0) {
+    cfg.metrics_port = cfg.daemon_mode ? DEFAULT_METRICS_PORT : 0;
+  }
+  // 共有メモリのカウンタは長時間実行（デーモンモード）でのみ既定で作成する
+  // 名前にプロセスIDを含め、複数のインスタンスが同じセグメントを使わないようにする
+  static char default_shm_name[64];
+  if (!cfg.shm_name) {
+    if (cfg.daemon_mode) {
+      snprintf(default_shm_name, sizeof(default_shm_name), "%s.%d",
+               DEFAULT_SHM_PREFIX, (int)getpid());
+      cfg.shm_name = default_shm_name;
+    } else {
+      cfg.shm_name = "";
+    }
+  }
+  if (tune.enabled) {
+    if (cfg.daemon_mode) {
+      fprintf(stderr, "--autotune cannot be combined with --daemon\n");
+      return 1;
+    }
+    if (tune.budget == 0) {
+      tune.budget = tune.strategy == STRATEGY_HILL_CLIMB
+                        ? DEFAULT_HILL_CLIMB_BUDGET
+                        : DEFAULT_HALVING_CANDIDATES;
+    }
+    if (tune.max_streams == 0) {
+      tune.max_streams = TUNE_LAST(tune_stream_counts);
+    }
+  }
+  if (workload_path) {
+    if (cfg.daemon_mode || tune.enabled) {
+      fprintf(stderr,
+              "--workload cannot be combined with --daemon or --autotune\n");
+      return 1;
+    }
+    if (workload_parse(workload_path, &workload) < 0) {
+      return 1;
+    }
+    if (workload.total_flows > MAX_STREAMS) {
+      fprintf(stderr, "Workload has %d flows (max %d)\n",
+              workload.total_flows, MAX_STREAMS);
+      return 1;
+    }
+  }
+
+  printf("devmem TCP goodput client\n");
+  printf("Server: %s port %d\n", cfg.server_ip, cfg.port);
+  printf("Data size per send: %d bytes\n", cfg.data_size);
+  if (cfg.daemon_mode) {
+    printf("Daemon mode: running until SIGTERM\n");
+  } else {
+    printf("Test duration: %d seconds\n", cfg.test_duration);
+  }
+  if (cfg.shm_name[0]) {
+    printf("Shared memory counters: %s\n", cfg.shm_name);
+  }
+  printf("Use devmem: %s\n", cfg.use_devmem ? "Yes" : "No");
+  printf("Interface: %s\n", cfg.interface_name);
+  if (!workload_path) {
+    printf("Streams: %d\n", cfg.num_streams);
+  }
+  if (cfg.sndbuf > 0) {
+    printf("Send buffer: %d bytes\n", cfg.sndbuf);
+  }
+  printf("Pattern: %s (seed %llu)\n", test_pattern_name(cfg.pattern),
+         (unsigned long long)cfg.seed);
+  if (cfg.num_local_addrs > 0) {
+    printf("Local addresses: %d\n", cfg.num_local_addrs);
+  }
+  if (workload_path) {
+    printf("Workload: %s (%d flows)\n", workload_path, workload.total_flows);
+    for (int i = 0; i < workload.nclasses; i++) {
+      flow_class_print(&workload.classes[i]);
+    }
+  }
+
+  setup_signals();
+
+  stats = devmem_stats_open(cfg.shm_name);
+  if (!stats) {
+    return 1;
+  }
+
+  // 送信データの準備（全ストリームで共有、読み取り専用）
+  // mmapで確保し、初期化スレッドが並列にページを確定させる
+  // 自動調整では最大の送信サイズ候補まで確保する（先頭から送るので周期は送信サイズ）
+  size_t data_len = cfg.data_size;
+  if (tune.enabled && data_len < (size_t)TUNE_LAST(tune_send_sizes)) {
+    data_len = TUNE_LAST(tune_send_sizes);
+  }
+  // 混合ワークロードでは最大のメッセージサイズまで確保する
+  for (int i = 0; workload_path && i < workload.nclasses; i++) {
+    if (data_len < (size_t)flow_class_max_size(&workload.classes[i])) {
+      data_len = flow_class_max_size(&workload.classes[i]);
+    }
+  }
+  char *data = mmap(NULL, data_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    perror("mmap failed");
+    devmem_stats_close(stats, cfg.shm_name);
+    return 1;
+  }
+  // 大きなバッファではページフォルト回数を減らす
+  madvise(data, data_len, MADV_HUGEPAGE);
+
+  // テストパターンでデータを初期化（全ページをここで確定させ、
+  // 測定区間内でページフォルトが起きないようにする）
+  long long fill_start = get_time_us();
+  int fill_threads = test_pattern_fill_parallel(data, data_len, cfg.pattern,
+                                                cfg.seed, cfg.fill_threads);
+  printf("Buffer initialized in %.3f ms (%d threads)\n",
+         (get_time_us() - fill_start) / 1000.0, fill_threads);
+
+  if (cfg.daemon_mode) {
+    devmem_metrics_start(&metrics, stats, "client", cfg.metrics_port);
+  }
+
+  // カーネル側トレース（サーバーのポートへ接続したソケットに絞り込む）
+  if (trace_enabled) {
+    devmem_trace_start(&trace, 0, cfg.port);
+  }
+
+  int status;
+  if (tune.enabled) {
+    status = autotune(&tune, &cfg, data, workers);
+  } else if (workload_path) {
+    status = run_workload(&cfg, &workload, data, flow_workers);
+  } else {
+    struct conn_result total;
+    status = run_streams(&cfg, data, workers, &total);
+    if (!cfg.daemon_mode && cfg.num_streams > 1 && total.end_time > 0) {
+      char title[64];
+      snprintf(title, sizeof(title), "Aggregate Results (%d streams)",
+               cfg.num_streams);
+      print_results(&total, title);
+    }
+  }
+
+  devmem_trace_stop(&trace);
+
+  // クリーンアップ
+  if (cfg.daemon_mode) {
+    devmem_metrics_stop(&metrics);
+  }
+  munmap(data, data_len);
+  devmem_stats_close(stats, cfg.shm_name);
+
+  return status;
+}
@@ -1,16 +1,33 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <linux/socket.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "devmem_control.h"
+#include "devmem_metrics.h"
+#include "devmem_trace.h"
+#include "latency_hist.h"
+#include "test_pattern.h"
+
 // devmem TCP用の構造体定義
 struct dmabuf_cmsg {
   uint32_t frag_token;
@@ -34,83 +51,406 @@ static inline long long get_time_us(void) {
 // TODO: correct?
 #define NETDEV_CMD_BIND_RX 1
 
-// グッドプット測定サーバー
-int main(int argc, char *argv[]) {
-  int server_fd, client_fd;
-  struct sockaddr_in server_addr, client_addr;
-  socklen_t client_len = sizeof(client_addr);
-  int port = 5201;
-  int measurement_duration = 10; // 測定時間（秒）
+// epollのbusy poll設定（Linux 6.9以降、古いヘッダ向けの定義）
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+  uint32_t busy_poll_usecs;
+  uint16_t busy_poll_budget;
+  uint8_t prefer_busy_poll;
+  uint8_t __pad;
+};
+#define EPOLL_IOC_TYPE 0x8A
+#define EPIOCSPARAMS _IOW(EPOLL_IOC_TYPE, 0x01, struct epoll_params)
+#endif
+
+// ナノ秒単位の単調時計（待ち時間測定用）
+static inline long long get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 受信待ち戦略
+enum wait_mode {
+  WAIT_BLOCK,     // ブロッキングrecvmsg
+  WAIT_BUSY_POLL, // SO_BUSY_POLL/SO_PREFER_BUSY_POLL付きのブロッキングrecvmsg
+  WAIT_EPOLL,     // EPIOCSPARAMSでbusy pollを有効にしたepoll
+  WAIT_SPIN,      // ノンブロッキングrecvmsgの空回し
+};
+
+static const char *const wait_mode_names[] = {
+    [WAIT_BLOCK] = "block",
+    [WAIT_BUSY_POLL] = "busypoll",
+    [WAIT_EPOLL] = "epoll",
+    [WAIT_SPIN] = "spin",
+};
+
+// 1回のrecvmsgで受け取る制御メッセージの最大数
+// 制御バッファが不足するとトークンが返却されずリークするため余裕を持たせる
+#define MAX_CMSGS_PER_RECV 128
+
+#define DEFAULT_METRICS_PORT 9464
+#define DEFAULT_SHM_PREFIX "/devmem_server_stats" // デーモンモードでは .<port> を付ける
+#define DEFAULT_BUSY_POLL_USEC 50
+#define DEFAULT_BUSY_POLL_BUDGET 64
+#define DEFAULT_VERIFY_PERIOD (1024 * 1024) // クライアントの既定data_size
+
+// 同時に処理する接続の最大数（クライアントの複数ストリーム用）
+#define MAX_CONNECTIONS 64
+
+// 1回のSO_DEVMEM_DONTNEEDで返却するトークン範囲の最大数（カーネルの上限）
+#define MAX_TOKEN_BATCH 128
+
+// サーバー設定
+struct server_config {
+  const char *bind_addr; // NULLの場合はデュアルスタックの全アドレス
+  int port;
+  int measurement_duration; // 測定時間（秒）
+  int daemon_mode;          // 時間制限なしで再接続を受け付け続ける
+  int metrics_port;         // 0の場合はエンドポイントを無効化
+  const char *shm_name;
+  enum wait_mode wait_mode;
+  int busy_poll_usec;   // SO_BUSY_POLL / epollのbusy poll時間
+  int busy_poll_budget; // 1回のbusy pollで処理するパケット数
+  int verify;           // リニアバッファに受信したデータを検証する
+  enum test_pattern verify_pattern;
+  uint64_t seed;
+  uint64_t verify_period; // クライアントの送信バッファサイズ（パターンの周期）
+  int control_port;       // 0の場合は制御チャネルを無効化
+  const char *control_bind; // 制御チャネルの待ち受けアドレス（認証が無いため既定はループバック）
+  int trace;              // 実行期間中カーネル側トレースを動かす
+};
+
+// 実行中に制御チャネルから変更できる設定（新しい接続から反映）
+struct server_tunables {
+  int rcvbuf;      // SO_RCVBUF（0: カーネルの自動調整）
+  int token_batch; // まとめて返却するトークン数
+};
+
+static struct server_tunables tunables = {
+    .rcvbuf = 0,
+    .token_batch = 1,
+};
+
+// 受信ごとに累積受信バイト数を返す接続の送信元ポート
+// （クライアントの混合ワークロードが応答時間を測るため、接続前に制御チャネルで登録する）
+// 登録は接続の直前に行われるため、ACK_PORT_TTL_NS 以内に接続が来なければ破棄する
+// （デーモンモードで溜まり続け、後の無関係な接続が古い登録を拾わないように）
+#define ACK_PORT_TTL_NS (10 * 1000000000LL)
+
+static struct {
+  pthread_mutex_t lock;
+  int ports[MAX_CONNECTIONS];
+  long long registered_ns[MAX_CONNECTIONS];
+  int count;
+} ack_ports = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// 返却待ちのトークン（連続するトークンは1つの範囲にまとめる）
+struct token_batch {
+  struct dmabuf_token ranges[MAX_TOKEN_BATCH];
+  int nranges;
+  int ntokens;
+  int limit;
+};
+
+// 1接続分の統計情報
+struct conn_result {
+  long long total_bytes;
+  long long total_packets;
+  long long devmem_bytes;
+  long long linear_bytes;
+  long long start_time;
+  long long end_time;
+  long long cpu_user_us; // 受信スレッドのCPU時間
+  long long cpu_sys_us;
+  struct latency_hist wait_latency; // recvmsgがデータを返すまでの待ち時間
+  long long stream_offset;  // ストリーム上の受信位置
+  long long verified_bytes; // パターン検証したバイト数
+  long long verify_errors;  // 不一致を含んだ受信チャンク数
+  long long first_mismatch; // 最初の不一致のストリームオフセット（-1: なし）
+};
 
-  // 統計情報
-  long long total_bytes = 0;
-  long long total_packets = 0;
-  long long devmem_bytes = 0;
-  long long linear_bytes = 0;
-  long long start_time, end_time;
+// 接続ごとの受信スレッド
+struct conn_worker {
+  pthread_t thread;
+  int in_use;
+  int done; // スレッド終了済み（メインスレッドがjoinする）
+  int fd;
+  int id;
+  int ack; // 受信ごとに累積受信バイト数を返す
+  char peer[INET6_ADDRSTRLEN + 16];
+  const struct server_config *cfg;
+  long long deadline;
+  struct conn_result res;
+};
+
+static struct devmem_stats *stats;
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t report_requested = 0;
 
-  if (argc > 1) {
-    port = atoi(argv[1]);
+// SIGTERM/SIGINT: 停止要求, SIGHUP: 累積統計の出力要求
+static void signal_handler(int sig) {
+  if (sig == SIGHUP) {
+    report_requested = 1;
+  } else {
+    stop_requested = 1;
   }
-  if (argc > 2) {
-    measurement_duration = atoi(argv[2]);
+}
+
+// シグナルハンドラを設定
+// SA_RESTARTを付けず、ブロッキング中のaccept/recvmsgをEINTRで中断させる
+static void setup_signals(void) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = signal_handler;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+}
+
+// 返却待ちのフラグメントトークンをまとめてカーネルに返却
+static void release_tokens(int client_fd, struct token_batch *b) {
+  if (b->nranges == 0) {
+    return;
   }
 
-  // ソケット作成
-  server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server_fd < 0) {
-    perror("socket creation failed");
-    return 1;
+  int ret = setsockopt(client_fd, SOL_SOCKET, SO_DEVMEM_DONTNEED, b->ranges,
+                       sizeof(b->ranges[0]) * b->nranges);
+  if (ret < 0) {
+    perror("SO_DEVMEM_DONTNEED failed");
+    STATS_ADD(stats, token_release_errors, 1);
+  } else {
+    STATS_ADD(stats, tokens_released, ret);
   }
+  b->nranges = 0;
+  b->ntokens = 0;
+}
 
-  // SO_REUSEADDRオプション設定
-  int opt = 1;
-  setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// トークンを返却待ちに追加し、バッチが埋まったら返却
+static void queue_token(int client_fd, struct token_batch *b,
+                        uint32_t frag_token) {
+  struct dmabuf_token *last =
+      b->nranges > 0 ? &b->ranges[b->nranges - 1] : NULL;
 
-  // アドレス設定
-  memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_addr.s_addr = INADDR_ANY;
-  server_addr.sin_port = htons(port);
+  if (last && last->token_start + last->token_count == frag_token) {
+    last->token_count++;
+  } else {
+    b->ranges[b->nranges].token_start = frag_token;
+    b->ranges[b->nranges].token_count = 1;
+    b->nranges++;
+  }
+  b->ntokens++;
 
-  // バインド
-  if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) <
-      0) {
-    perror("bind failed");
-    close(server_fd);
-    return 1;
+  if (b->ntokens >= b->limit || b->nranges == MAX_TOKEN_BATCH) {
+    release_tokens(client_fd, b);
   }
+}
 
-  // リスニング
-  if (listen(server_fd, 1) < 0) {
-    perror("listen failed");
-    close(server_fd);
-    return 1;
+// 累積統計を表示（デーモンモードのSIGHUP時と終了時）
+static void print_cumulative_stats(void) {
+  devmem_stats_update_usage(stats);
+
+  printf("\n=== Cumulative Statistics ===\n");
+  printf("Connections: %llu total, %lld active\n",
+         (unsigned long long)STATS_LOAD(stats, connections_total),
+         (long long)STATS_LOAD(stats, connections_active));
+  printf("Total bytes received: %llu bytes\n",
+         (unsigned long long)STATS_LOAD(stats, bytes_total));
+  printf("Device memory bytes: %llu bytes\n",
+         (unsigned long long)STATS_LOAD(stats, devmem_bytes));
+  printf("Linear buffer bytes: %llu bytes\n",
+         (unsigned long long)STATS_LOAD(stats, linear_bytes));
+  printf("Tokens: %llu received, %llu released, %llu release errors\n",
+         (unsigned long long)STATS_LOAD(stats, tokens_received),
+         (unsigned long long)STATS_LOAD(stats, tokens_released),
+         (unsigned long long)STATS_LOAD(stats, token_release_errors));
+  printf("CPU time: user %.3fs, system %.3fs\n",
+         STATS_LOAD(stats, cpu_user_us) / 1000000.0,
+         STATS_LOAD(stats, cpu_sys_us) / 1000000.0);
+  printf("RSS: %llu bytes\n", (unsigned long long)STATS_LOAD(stats, rss_bytes));
+  fflush(stdout);
+}
+
+// スレッドのCPU時間を取得（マイクロ秒）
+static void get_thread_cpu_us(long long *user_us, long long *sys_us) {
+  struct rusage ru;
+  getrusage(RUSAGE_THREAD, &ru);
+  *user_us = ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec;
+  *sys_us = ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+}
+
+static int parse_wait_mode(const char *name, enum wait_mode *mode) {
+  for (size_t i = 0; i < sizeof(wait_mode_names) / sizeof(wait_mode_names[0]);
+       i++) {
+    if (strcmp(name, wait_mode_names[i]) == 0) {
+      *mode = i;
+      return 0;
+    }
   }
+  return -1;
+}
 
-  printf("devmem TCP goodput server listening on port %d\n", port);
-  printf("Measurement duration: %d seconds\n", measurement_duration);
+// 受信待ち戦略に応じてソケットを設定
+// WAIT_EPOLLの場合はbusy poll設定済みのepoll fdを epfd に返す
+static int setup_wait_strategy(const struct server_config *cfg, int client_fd,
+                               int *epfd) {
+  int opt;
 
-  // クライアント接続を待機
-  client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-  if (client_fd < 0) {
-    perror("accept failed");
-    close(server_fd);
-    return 1;
+  *epfd = -1;
+
+  switch (cfg->wait_mode) {
+  case WAIT_BLOCK:
+    return 0;
+
+  case WAIT_BUSY_POLL:
+    opt = cfg->busy_poll_usec;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_BUSY_POLL, &opt, sizeof(opt)) <
+        0) {
+      perror("SO_BUSY_POLL failed");
+      return -1;
+    }
+    opt = 1;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt,
+                   sizeof(opt)) < 0) {
+      perror("SO_PREFER_BUSY_POLL failed");
+      // 警告として継続
+    }
+    opt = cfg->busy_poll_budget;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &opt,
+                   sizeof(opt)) < 0) {
+      perror("SO_BUSY_POLL_BUDGET failed");
+      // 警告として継続
+    }
+    return 0;
+
+  case WAIT_EPOLL: {
+    struct epoll_event ev;
+    struct epoll_params params;
+
+    *epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (*epfd < 0) {
+      perror("epoll_create1 failed");
+      return -1;
+    }
+
+    memset(&params, 0, sizeof(params));
+    params.busy_poll_usecs = cfg->busy_poll_usec;
+    params.busy_poll_budget = cfg->busy_poll_budget;
+    params.prefer_busy_poll = 1;
+    if (ioctl(*epfd, EPIOCSPARAMS, &params) < 0) {
+      perror("EPIOCSPARAMS failed");
+      // 警告として継続（通常のepollとして動作）
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = client_fd;
+    if (epoll_ctl(*epfd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+      perror("epoll_ctl failed");
+      close(*epfd);
+      *epfd = -1;
+      return -1;
+    }
+  }
+    // epollとspinはノンブロッキングソケットを使う
+    // fallthrough
+  case WAIT_SPIN: {
+    int flags = fcntl(client_fd, F_GETFL);
+    if (flags < 0 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+      perror("fcntl O_NONBLOCK failed");
+      return -1;
+    }
+    return 0;
+  }
+  }
+
+  return -1;
+}
+
+// 受信待ち戦略に従ってデータを待ち、recvmsgの結果を返す
+static ssize_t wait_and_recv(const struct server_config *cfg, int client_fd,
+                             int epfd, struct msghdr *msg, long long deadline) {
+  for (;;) {
+    ssize_t ret = recvmsg(client_fd, msg, MSG_SOCK_DEVMEM);
+    if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return ret;
+    }
+    if (stop_requested || (deadline != 0 && get_time_us() >= deadline)) {
+      return ret;
+    }
+
+    if (cfg->wait_mode == WAIT_EPOLL) {
+      // 停止要求と期限を確認できるようタイムアウト付きで待つ
+      struct epoll_event ev;
+      if (epoll_wait(epfd, &ev, 1, 100) < 0 && errno != EINTR) {
+        perror("epoll_wait failed");
+        return -1;
+      }
+    }
+    // WAIT_SPIN: そのまま再試行
   }
+}
 
-  printf("Client connected from %s\n", inet_ntoa(client_addr.sin_addr));
+// 受信データを期待パターンと比較
+// 送信側は verify_period バイトのバッファを繰り返し送るため、周期ごとに分割して検証する
+static void verify_received(const struct server_config *cfg,
+                            struct conn_result *res, const char *buf,
+                            size_t len) {
+  while (len > 0) {
+    uint64_t pos = res->stream_offset % cfg->verify_period;
+    size_t n = cfg->verify_period - pos < len ? cfg->verify_period - pos : len;
 
-  // 測定開始
-  start_time = get_time_us();
-  long long measurement_end = start_time + measurement_duration * 1000000LL;
+    ssize_t bad =
+        test_pattern_verify(buf, n, pos, cfg->verify_pattern, cfg->seed);
+    if (bad >= 0) {
+      if (res->verify_errors == 0) {
+        res->first_mismatch = res->stream_offset + bad;
+      }
+      res->verify_errors++;
+    }
+    res->verified_bytes += n;
+    res->stream_offset += n;
+    buf += n;
+    len -= n;
+  }
+}
 
+// 1接続分の受信ループ
+// deadline が 0 の場合は切断または停止要求まで受信を続ける
+// ack が真の場合は受信ごとに累積受信バイト数（8バイト、ビッグエンディアン）を返す
+static void serve_connection(const struct server_config *cfg, int client_fd,
+                             long long deadline, int ack,
+                             struct conn_result *res) {
   // 受信バッファとメッセージ構造体
   char buffer[65536];
-  char ctrl_buffer[CMSG_SPACE(sizeof(struct dmabuf_cmsg))];
+  char ctrl_buffer[CMSG_SPACE(sizeof(struct dmabuf_cmsg)) * MAX_CMSGS_PER_RECV];
   struct msghdr msg;
   struct iovec iov;
   struct cmsghdr *cmsg;
+  long long last_report = 0;
+  struct token_batch tokens;
+
+  long long cpu_user_start, cpu_sys_start;
+  int epfd;
+
+  memset(res, 0, sizeof(*res));
+  res->first_mismatch = -1;
+  memset(&tokens, 0, sizeof(tokens));
+  tokens.limit = __atomic_load_n(&tunables.token_batch, __ATOMIC_RELAXED);
+
+  if (setup_wait_strategy(cfg, client_fd, &epfd) < 0) {
+    fprintf(stderr, "Failed to set up wait strategy %s\n",
+            wait_mode_names[cfg->wait_mode]);
+    STATS_ADD(stats, errors_total, 1);
+    res->start_time = res->end_time = get_time_us();
+    return;
+  }
+
+  res->start_time = get_time_us();
+  get_thread_cpu_us(&cpu_user_start, &cpu_sys_start);
 
   // メッセージ構造体初期化
   memset(&msg, 0, sizeof(msg));
@@ -124,26 +464,53 @@ int main(int argc, char *argv[]) {
   printf("Starting measurement...\n");
 
   // メインループ
-  while (get_time_us() < measurement_end) {
+  while (!stop_requested && (deadline == 0 || get_time_us() < deadline)) {
+    // recvmsgが制御メッセージ長を書き換えるため毎回戻す
+    msg.msg_controllen = sizeof(ctrl_buffer);
+
     // MSG_SOCK_DEVMEMフラグを使用してdevmemデータを受信
-    ssize_t bytes_received = recvmsg(client_fd, &msg, MSG_SOCK_DEVMEM);
+    long long wait_start = get_time_ns();
+    ssize_t bytes_received =
+        wait_and_recv(cfg, client_fd, epfd, &msg, deadline);
 
     if (bytes_received <= 0) {
       if (bytes_received == 0) {
-        printf("Connection closed by client\n");
+        // 停止時はメインスレッドがshutdownで受信を打ち切る
+        if (!stop_requested && (deadline == 0 || get_time_us() < deadline)) {
+          printf("Connection closed by client\n");
+        }
         break;
       }
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
         continue;
       }
       perror("recvmsg failed");
+      STATS_ADD(stats, errors_total, 1);
       break;
     }
 
-    total_bytes += bytes_received;
-    total_packets++;
+    if (msg.msg_flags & MSG_CTRUNC) {
+      fprintf(stderr, "Control message truncated, tokens may leak\n");
+      STATS_ADD(stats, errors_total, 1);
+    }
+
+    latency_hist_add(&res->wait_latency, get_time_ns() - wait_start);
+    res->total_bytes += bytes_received;
+    res->total_packets++;
+    STATS_ADD(stats, bytes_total, bytes_received);
+    STATS_ADD(stats, packets_total, 1);
+
+    // 累積値なので送信バッファが一杯で落としても次の応答で補われる
+    if (ack) {
+      uint64_t acked = htobe64(res->total_bytes);
+      send(client_fd, &acked, sizeof(acked), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
 
-    // 制御メッセージを解析
+    // devmemの制御メッセージが無ければ全体がリニアバッファに入っている
+    size_t linear_pos = 0;
+    int has_devmem_cmsg = 0;
+
+    // 制御メッセージを解析（ストリーム順に並んでいる）
     for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
       if (cmsg->cmsg_level != SOL_SOCKET) {
         continue;
@@ -153,64 +520,762 @@ int main(int argc, char *argv[]) {
 
       if (cmsg->cmsg_type == SCM_DEVMEM_DMABUF) {
         // デバイスメモリに受信されたフラグメント
-        devmem_bytes += dmabuf_cmsg->frag_size;
-
-        printf("Devmem frag: dmabuf_id=%u, offset=%u, size=%u, token=%u\n",
-               dmabuf_cmsg->dmabuf_id, dmabuf_cmsg->frag_offset,
-               dmabuf_cmsg->frag_size, dmabuf_cmsg->frag_token);
+        // CPUからは参照できないため検証対象外（オフセットのみ進める）
+        has_devmem_cmsg = 1;
+        res->stream_offset += dmabuf_cmsg->frag_size;
+        res->devmem_bytes += dmabuf_cmsg->frag_size;
+        STATS_ADD(stats, devmem_bytes, dmabuf_cmsg->frag_size);
+        STATS_ADD(stats, tokens_received, 1);
 
-        // フラグメントを解放
-        struct dmabuf_token token;
-        token.token_start = dmabuf_cmsg->frag_token;
-        token.token_count = 1;
-
-        int ret = setsockopt(client_fd, SOL_SOCKET, SO_DEVMEM_DONTNEED, &token,
-                             sizeof(token));
-        if (ret < 0) {
-          perror("SO_DEVMEM_DONTNEED failed");
+        // 長時間実行ではログが肥大化するためフラグメント単位の表示は行わない
+        if (!cfg->daemon_mode) {
+          printf("Devmem frag: dmabuf_id=%u, offset=%u, size=%u, token=%u\n",
+                 dmabuf_cmsg->dmabuf_id, dmabuf_cmsg->frag_offset,
+                 dmabuf_cmsg->frag_size, dmabuf_cmsg->frag_token);
         }
+
+        // フラグメントを解放（token_batch 個ごとにまとめて返却）
+        queue_token(client_fd, &tokens, dmabuf_cmsg->frag_token);
       } else if (cmsg->cmsg_type == SCM_DEVMEM_LINEAR) {
         // リニアバッファに受信されたフラグメント
-        linear_bytes += dmabuf_cmsg->frag_size;
-        printf("Linear frag: size=%u\n", dmabuf_cmsg->frag_size);
+        has_devmem_cmsg = 1;
+        if (cfg->verify) {
+          verify_received(cfg, res, buffer + linear_pos,
+                          dmabuf_cmsg->frag_size);
+        } else {
+          res->stream_offset += dmabuf_cmsg->frag_size;
+        }
+        linear_pos += dmabuf_cmsg->frag_size;
+        res->linear_bytes += dmabuf_cmsg->frag_size;
+        STATS_ADD(stats, linear_bytes, dmabuf_cmsg->frag_size);
+        if (!cfg->daemon_mode) {
+          printf("Linear frag: size=%u\n", dmabuf_cmsg->frag_size);
+        }
+      }
+    }
+
+    if (!has_devmem_cmsg) {
+      if (cfg->verify) {
+        verify_received(cfg, res, buffer, bytes_received);
+      } else {
+        res->stream_offset += bytes_received;
       }
     }
 
-    // 1秒ごとに進捗を表示
-    static long long last_report = 0;
+    // 1秒ごとに進捗を表示（デーモンモードでは10秒ごと）
+    long long report_interval = cfg->daemon_mode ? 10000000 : 1000000;
     long long current_time = get_time_us();
-    if (current_time - last_report >= 1000000) {
-      double elapsed = (current_time - start_time) / 1000000.0;
-      double current_goodput = total_bytes / elapsed / 1024.0 / 1024.0 * 8.0;
+    if (current_time - last_report >= report_interval) {
+      double elapsed = (current_time - res->start_time) / 1000000.0;
+      double current_goodput =
+          res->total_bytes / elapsed / 1024.0 / 1024.0 * 8.0;
       printf("Elapsed: %.1fs, Goodput: %.2f Mbps, Packets: %lld\n", elapsed,
-             current_goodput, total_packets);
+             current_goodput, res->total_packets);
       last_report = current_time;
     }
   }
 
-  end_time = get_time_us();
+  // バッチに残ったトークンを返却
+  release_tokens(client_fd, &tokens);
+
+  res->end_time = get_time_us();
+  get_thread_cpu_us(&res->cpu_user_us, &res->cpu_sys_us);
+  res->cpu_user_us -= cpu_user_start;
+  res->cpu_sys_us -= cpu_sys_start;
+
+  if (epfd >= 0) {
+    close(epfd);
+  }
+}
 
-  // 結果の計算と表示
-  double duration = (end_time - start_time) / 1000000.0;
-  double goodput_mbps = total_bytes / duration / 1024.0 / 1024.0 * 8.0;
-  double packet_rate = total_packets / duration;
+// 1接続分の結果を表示
+static void print_results(const struct server_config *cfg,
+                          const struct conn_result *res, const char *title) {
+  double duration = (res->end_time - res->start_time) / 1000000.0;
+  double goodput_mbps = res->total_bytes / duration / 1024.0 / 1024.0 * 8.0;
+  double packet_rate = res->total_packets / duration;
 
-  printf("\n=== Measurement Results ===\n");
+  printf("\n=== %s ===\n", title);
   printf("Duration: %.3f seconds\n", duration);
-  printf("Total bytes received: %lld bytes\n", total_bytes);
-  printf("Total packets received: %lld packets\n", total_packets);
-  printf("Device memory bytes: %lld bytes (%.1f%%)\n", devmem_bytes,
-         devmem_bytes * 100.0 / total_bytes);
-  printf("Linear buffer bytes: %lld bytes (%.1f%%)\n", linear_bytes,
-         linear_bytes * 100.0 / total_bytes);
+  printf("Total bytes received: %lld bytes\n", res->total_bytes);
+  printf("Total packets received: %lld packets\n", res->total_packets);
+  printf("Device memory bytes: %lld bytes (%.1f%%)\n", res->devmem_bytes,
+         res->devmem_bytes * 100.0 / res->total_bytes);
+  printf("Linear buffer bytes: %lld bytes (%.1f%%)\n", res->linear_bytes,
+         res->linear_bytes * 100.0 / res->total_bytes);
   printf("Goodput: %.2f Mbps\n", goodput_mbps);
   printf("Packet rate: %.2f packets/sec\n", packet_rate);
   printf("Average packet size: %.1f bytes\n",
-         total_packets > 0 ? (double)total_bytes / total_packets : 0);
+         res->total_packets > 0 ? (double)res->total_bytes / res->total_packets
+                                : 0);
+
+  // 受信待ち戦略ごとのレイテンシとCPUコスト
+  const struct latency_hist *h = &res->wait_latency;
+  double cpu_total_us = res->cpu_user_us + res->cpu_sys_us;
+  printf("Wait strategy: %s", wait_mode_names[cfg->wait_mode]);
+  if (cfg->wait_mode == WAIT_BUSY_POLL || cfg->wait_mode == WAIT_EPOLL) {
+    printf(" (busy_poll=%dus, budget=%d)", cfg->busy_poll_usec,
+           cfg->busy_poll_budget);
+  }
+  printf("\n");
+  printf("Recv wait latency: avg %.2f us, p50 %.2f us, p99 %.2f us, "
+         "p99.9 %.2f us, max %.2f us\n",
+         h->count > 0 ? (double)h->sum_ns / h->count / 1000.0 : 0,
+         latency_hist_percentile(h, 50) / 1000.0,
+         latency_hist_percentile(h, 99) / 1000.0,
+         latency_hist_percentile(h, 99.9) / 1000.0, h->max_ns / 1000.0);
+  printf("CPU time: user %.3fs, system %.3fs (%.1f%% of one core)\n",
+         res->cpu_user_us / 1000000.0, res->cpu_sys_us / 1000000.0,
+         cpu_total_us / 10000.0 / duration);
+  printf("CPU cost: %.2f us/MB\n",
+         res->total_bytes > 0
+             ? cpu_total_us / (res->total_bytes / 1024.0 / 1024.0)
+             : 0);
+  if (cfg->verify) {
+    printf("Verified bytes: %lld (pattern %s), mismatched chunks: %lld",
+           res->verified_bytes, test_pattern_name(cfg->verify_pattern),
+           res->verify_errors);
+    if (res->verify_errors > 0) {
+      printf(", first at stream offset %lld", res->first_mismatch);
+    }
+    printf("\n");
+  }
+  fflush(stdout);
+}
+
+// 複数接続の結果を合算
+static void merge_results(struct conn_result *total,
+                          const struct conn_result *res) {
+  if (total->start_time == 0 || res->start_time < total->start_time) {
+    total->start_time = res->start_time;
+  }
+  if (res->end_time > total->end_time) {
+    total->end_time = res->end_time;
+  }
+  total->total_bytes += res->total_bytes;
+  total->total_packets += res->total_packets;
+  total->devmem_bytes += res->devmem_bytes;
+  total->linear_bytes += res->linear_bytes;
+  total->cpu_user_us += res->cpu_user_us;
+  total->cpu_sys_us += res->cpu_sys_us;
+  total->verified_bytes += res->verified_bytes;
+  total->verify_errors += res->verify_errors;
+
+  latency_hist_merge(&total->wait_latency, &res->wait_latency);
+}
+
+// アドレスを "addr:port" / "[addr]:port" 形式で文字列化
+static const char *format_sockaddr(const struct sockaddr_storage *ss,
+                                   char *buf, size_t len) {
+  char host[INET6_ADDRSTRLEN];
+
+  if (ss->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+    inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+    snprintf(buf, len, "[%s]:%d", host, ntohs(sin6->sin6_port));
+  } else {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+    inet_ntop(AF_INET, &sin->sin_addr, host, sizeof(host));
+    snprintf(buf, len, "%s:%d", host, ntohs(sin->sin_port));
+  }
+  return buf;
+}
+
+// リスニングソケットを作成
+// bind_addr がNULLの場合はIPv6デュアルスタック（IPv6が無ければIPv4）で待ち受ける
+static int create_listen_socket(const struct server_config *cfg) {
+  struct addrinfo hints, *res = NULL, *ai;
+  char port_str[16];
+  int server_fd = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = cfg->bind_addr ? AF_UNSPEC : AF_INET6;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+  snprintf(port_str, sizeof(port_str), "%d", cfg->port);
+
+  int ret = getaddrinfo(cfg->bind_addr, port_str, &hints, &res);
+  if (ret != 0 && !cfg->bind_addr) {
+    hints.ai_family = AF_INET;
+    ret = getaddrinfo(NULL, port_str, &hints, &res);
+  }
+  if (ret != 0) {
+    fprintf(stderr, "Invalid bind address: %s\n", gai_strerror(ret));
+    return -1;
+  }
+
+  for (ai = res; ai; ai = ai->ai_next) {
+    // ソケット作成
+    server_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (server_fd < 0) {
+      continue;
+    }
+
+    // SO_REUSEADDRオプション設定
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // 全アドレスで待ち受ける場合はIPv4射影アドレスも受け付ける
+    if (ai->ai_family == AF_INET6 && !cfg->bind_addr) {
+      opt = 0;
+      setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
+    }
+
+    // バインド
+    if (bind(server_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    perror("bind failed");
+    close(server_fd);
+    server_fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (server_fd < 0) {
+    // IPv6が無効なホストではIPv4で再試行
+    if (!cfg->bind_addr && hints.ai_family == AF_INET6) {
+      struct server_config v4 = *cfg;
+      v4.bind_addr = "0.0.0.0";
+      return create_listen_socket(&v4);
+    }
+    return -1;
+  }
+
+  // リスニング
+  if (listen(server_fd, MAX_CONNECTIONS) < 0) {
+    perror("listen failed");
+    close(server_fd);
+    return -1;
+  }
+
+  return server_fd;
+}
+
+// 受信スレッド本体
+static void *conn_worker_main(void *arg) {
+  struct conn_worker *w = arg;
+
+  serve_connection(w->cfg, w->fd, w->deadline, w->ack, &w->res);
+  __atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// 受信スレッドを開始（シグナルはメインスレッドのみで受ける）
+static int start_worker(struct conn_worker *w) {
+  sigset_t all, old;
+  int ret;
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  ret = pthread_create(&w->thread, NULL, conn_worker_main, w);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  return ret == 0 ? 0 : -1;
+}
+
+// 終了した受信スレッドを回収して結果を表示
+static void reap_worker(struct conn_worker *w, int multi,
+                        struct conn_result *total) {
+  char title[128];
+
+  pthread_join(w->thread, NULL);
+
+  if (multi) {
+    snprintf(title, sizeof(title), "Measurement Results (stream %d, %s)",
+             w->id, w->peer);
+  } else {
+    snprintf(title, sizeof(title), "Measurement Results");
+  }
+  print_results(w->cfg, &w->res, title);
+  if (total) {
+    merge_results(total, &w->res);
+  }
+
+  close(w->fd);
+  STATS_ADD(stats, connections_active, -1);
+  w->in_use = 0;
+  w->done = 0;
+}
+
+// SO_RCVBUF に bytes を設定したときに実際に効くサイズ（0: 自動調整）
+// 次の接続に適用するまで分からないため、作業用ソケットで確かめる
+static long long effective_rcvbuf(int bytes) {
+  if (bytes <= 0) {
+    return 0;
+  }
+  int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  }
+  if (fd < 0) {
+    return bytes;
+  }
+  int effective = devmem_set_buffer_size(fd, SO_RCVBUF, bytes);
+  close(fd);
+  return effective < 0 ? bytes : effective;
+}
+
+// 期限切れの登録を削除（ack_ports.lock を保持して呼ぶ）
+static void expire_ack_ports(long long now) {
+  for (int i = 0; i < ack_ports.count;) {
+    if (now - ack_ports.registered_ns[i] > ACK_PORT_TTL_NS) {
+      ack_ports.count--;
+      ack_ports.ports[i] = ack_ports.ports[ack_ports.count];
+      ack_ports.registered_ns[i] = ack_ports.registered_ns[ack_ports.count];
+    } else {
+      i++;
+    }
+  }
+}
+
+// 制御チャネルからの設定変更
+static int server_control_set(void *arg, const char *key, long long value,
+                              long long *applied) {
+  (void)arg;
+
+  if (strcmp(key, "rcvbuf") == 0 && value >= 0 && value <= INT32_MAX) {
+    __atomic_store_n(&tunables.rcvbuf, (int)value, __ATOMIC_RELAXED);
+    *applied = effective_rcvbuf((int)value);
+    return 0;
+  }
+  if (strcmp(key, "token_batch") == 0 && value >= 1 &&
+      value <= MAX_TOKEN_BATCH) {
+    __atomic_store_n(&tunables.token_batch, (int)value, __ATOMIC_RELAXED);
+    return 0;
+  }
+  if (strcmp(key, "ack_port") == 0 && value > 0 && value <= 65535) {
+    int ret = -1;
+    long long now = get_time_ns();
+    pthread_mutex_lock(&ack_ports.lock);
+    expire_ack_ports(now);
+    if (ack_ports.count < MAX_CONNECTIONS) {
+      ack_ports.ports[ack_ports.count] = (int)value;
+      ack_ports.registered_ns[ack_ports.count] = now;
+      ack_ports.count++;
+      ret = 0;
+    }
+    pthread_mutex_unlock(&ack_ports.lock);
+    return ret;
+  }
+  return -1;
+}
+
+// 送信元ポートが応答要求として登録されていれば登録を消費して真を返す
+static int take_ack_port(const struct sockaddr_storage *ss) {
+  int port, found = 0;
+
+  if (ss->ss_family == AF_INET6) {
+    port = ntohs(((const struct sockaddr_in6 *)ss)->sin6_port);
+  } else {
+    port = ntohs(((const struct sockaddr_in *)ss)->sin_port);
+  }
+
+  pthread_mutex_lock(&ack_ports.lock);
+  expire_ack_ports(get_time_ns());
+  for (int i = 0; i < ack_ports.count; i++) {
+    if (ack_ports.ports[i] == port) {
+      ack_ports.count--;
+      ack_ports.ports[i] = ack_ports.ports[ack_ports.count];
+      ack_ports.registered_ns[i] = ack_ports.registered_ns[ack_ports.count];
+      found = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ack_ports.lock);
+
+  return found;
+}
+
+// 受け付けた接続に受信バッファサイズを設定（0の場合はカーネルの自動調整のまま）
+// リスニングソケットに設定すると自動調整に戻せないため接続ごとに設定する
+static void apply_rcvbuf(int client_fd) {
+  static int clamp_warned;
+  int rcvbuf = __atomic_load_n(&tunables.rcvbuf, __ATOMIC_RELAXED);
+
+  if (rcvbuf <= 0) {
+    return;
+  }
+  int effective = devmem_set_buffer_size(client_fd, SO_RCVBUF, rcvbuf);
+  if (effective < 0) {
+    perror("SO_RCVBUF failed");
+    // 警告として継続
+  } else if (effective < rcvbuf && !clamp_warned) {
+    clamp_warned = 1;
+    fprintf(stderr,
+            "Warning: SO_RCVBUF %d clamped to %d by net.core.rmem_max "
+            "(raise it or run with CAP_NET_ADMIN)\n",
+            rcvbuf, effective);
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [options] [port] [duration_sec]\n"
+          "  -D, --daemon             run until SIGTERM, accepting reconnects\n"
+          "  -a, --bind ADDR          listen address, IPv4 or IPv6 "
+          "(default: dual-stack any)\n"
+          "  -m, --metrics-port PORT  Prometheus endpoint on 127.0.0.1 "
+          "(default %d in daemon mode, 0 disables)\n"
+          "  -s, --shm NAME           shared memory segment for counters "
+          "(daemon mode default %s.<port>,\n"
+          "                           \"\" disables; otherwise none)\n"
+          "  -w, --wait-mode MODE     block | busypoll | epoll | spin "
+          "(default block)\n"
+          "  -b, --busy-poll-usec N   busy poll time for busypoll/epoll "
+          "(default %d)\n"
+          "  -B, --busy-poll-budget N packets per busy poll (default %d)\n"
+          "  -V, --verify PATTERN     check linear payload against "
+          "increment | prng | incompressible\n"
+          "  -S, --seed N             pattern seed, must match the client "
+          "(default 1)\n"
+          "  -z, --verify-period N    client data_size, the pattern period "
+          "(default %d)\n"
+          "  -r, --rcvbuf BYTES       SO_RCVBUF per connection "
+          "(default 0: kernel autotuning)\n"
+          "  -t, --token-batch N      devmem tokens per SO_DEVMEM_DONTNEED "
+          "(default 1, max %d)\n"
+          "  -c, --control-port PORT  accept SET/STATS commands from "
+          "devmem_client --autotune/--workload\n"
+          "                           (default 0: off)\n"
+          "  -C, --control-bind ADDR  control channel address (default "
+          "127.0.0.1; the channel is\n"
+          "                           unauthenticated, expose it only on "
+          "trusted networks)\n"
+          "  -K, --trace              run bpftrace probes on the receive, "
+          "zerocopy and page_pool\n"
+          "                           paths and append the histograms to the "
+          "report (needs root)\n",
+          prog, DEFAULT_METRICS_PORT, DEFAULT_SHM_PREFIX, DEFAULT_BUSY_POLL_USEC,
+          DEFAULT_BUSY_POLL_BUDGET, DEFAULT_VERIFY_PERIOD, MAX_TOKEN_BATCH);
+}
+
+// グッドプット測定サーバー
+int main(int argc, char *argv[]) {
+  int server_fd, client_fd;
+  struct sockaddr_storage client_addr;
+  socklen_t client_len;
+  struct server_config cfg = {
+      .bind_addr = NULL,
+      .port = 5201,
+      .measurement_duration = 10,
+      .daemon_mode = 0,
+      .metrics_port = -1,
+      .shm_name = NULL,
+      .wait_mode = WAIT_BLOCK,
+      .busy_poll_usec = DEFAULT_BUSY_POLL_USEC,
+      .busy_poll_budget = DEFAULT_BUSY_POLL_BUDGET,
+      .verify = 0,
+      .verify_pattern = PATTERN_INCREMENT,
+      .seed = 1,
+      .verify_period = DEFAULT_VERIFY_PERIOD,
+      .control_port = 0,
+      .control_bind = "127.0.0.1",
+      .trace = 0,
+  };
+  struct devmem_metrics_server metrics;
+  struct devmem_control_server control;
+  struct devmem_trace trace = {.pid = -1, .fd = -1};
+  static struct conn_worker workers[MAX_CONNECTIONS];
+  static const struct option long_options[] = {
+      {"daemon", no_argument, NULL, 'D'},
+      {"bind", required_argument, NULL, 'a'},
+      {"metrics-port", required_argument, NULL, 'm'},
+      {"shm", required_argument, NULL, 's'},
+      {"wait-mode", required_argument, NULL, 'w'},
+      {"busy-poll-usec", required_argument, NULL, 'b'},
+      {"busy-poll-budget", required_argument, NULL, 'B'},
+      {"verify", required_argument, NULL, 'V'},
+      {"seed", required_argument, NULL, 'S'},
+      {"verify-period", required_argument, NULL, 'z'},
+      {"rcvbuf", required_argument, NULL, 'r'},
+      {"token-batch", required_argument, NULL, 't'},
+      {"control-port", required_argument, NULL, 'c'},
+      {"control-bind", required_argument, NULL, 'C'},
+      {"trace", no_argument, NULL, 'K'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "Da:m:s:w:b:B:V:S:z:r:t:c:C:Kh", long_options,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'D':
+      cfg.daemon_mode = 1;
+      break;
+    case 'a':
+      cfg.bind_addr = optarg;
+      break;
+    case 'm':
+      cfg.metrics_port = atoi(optarg);
+      break;
+    case 's':
+      cfg.shm_name = optarg;
+      break;
+    case 'w':
+      if (parse_wait_mode(optarg, &cfg.wait_mode) < 0) {
+        fprintf(stderr, "Unknown wait mode: %s\n", optarg);
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'b':
+      cfg.busy_poll_usec = atoi(optarg);
+      break;
+    case 'B':
+      cfg.busy_poll_budget = atoi(optarg);
+      break;
+    case 'V':
+      if (test_pattern_parse(optarg, &cfg.verify_pattern) < 0) {
+        fprintf(stderr, "Unknown pattern: %s\n", optarg);
+        usage(argv[0]);
+        return 1;
+      }
+      cfg.verify = 1;
+      break;
+    case 'S':
+      cfg.seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'z':
+      cfg.verify_period = strtoull(optarg, NULL, 0);
+      if (cfg.verify_period == 0) {
+        fprintf(stderr, "Invalid verify period: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'r':
+      tunables.rcvbuf = atoi(optarg);
+      break;
+    case 't':
+      tunables.token_batch = atoi(optarg);
+      if (tunables.token_batch < 1 || tunables.token_batch > MAX_TOKEN_BATCH) {
+        fprintf(stderr, "Invalid token batch: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'c':
+      cfg.control_port = atoi(optarg);
+      break;
+    case 'C':
+      cfg.control_bind = optarg;
+      break;
+    case 'K':
+      cfg.trace = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  // 従来どおりの位置引数
+  if (optind < argc) {
+    cfg.port = atoi(argv[optind++]);
+  }
+  if (optind < argc) {
+    cfg.measurement_duration = atoi(argv[optind++]);
+  }
+  if (cfg.metrics_port < 0) {
+    cfg.metrics_port = cfg.daemon_mode ? DEFAULT_METRICS_PORT : 0;
+  }
+  // 共有メモリのカウンタは長時間実行（デーモンモード）でのみ既定で作成する
+  // 名前に待ち受けポートを含め、複数のインスタンスが同じセグメントを使わないようにする
+  static char default_shm_name[64];
+  if (!cfg.shm_name) {
+    if (cfg.daemon_mode) {
+      snprintf(default_shm_name, sizeof(default_shm_name), "%s.%d",
+               DEFAULT_SHM_PREFIX, cfg.port);
+      cfg.shm_name = default_shm_name;
+    } else {
+      cfg.shm_name = "";
+    }
+  }
+
+  setup_signals();
+
+  stats = devmem_stats_open(cfg.shm_name);
+  if (!stats) {
+    return 1;
+  }
+
+  server_fd = create_listen_socket(&cfg);
+  if (server_fd < 0) {
+    devmem_stats_close(stats, cfg.shm_name);
+    return 1;
+  }
+
+  printf("devmem TCP goodput server listening on %s port %d\n",
+         cfg.bind_addr ? cfg.bind_addr : "all addresses", cfg.port);
+  if (cfg.daemon_mode) {
+    printf("Daemon mode: running until SIGTERM (SIGHUP prints statistics)\n");
+    devmem_metrics_start(&metrics, stats, "server", cfg.metrics_port);
+  } else {
+    printf("Measurement duration: %d seconds\n", cfg.measurement_duration);
+  }
+  if (cfg.shm_name[0]) {
+    printf("Shared memory counters: %s\n", cfg.shm_name);
+  }
+  printf("Wait strategy: %s\n", wait_mode_names[cfg.wait_mode]);
+  if (tunables.rcvbuf > 0) {
+    printf("Receive buffer: %d bytes\n", tunables.rcvbuf);
+  }
+  printf("Token batch: %d\n", tunables.token_batch);
+
+  // カーネル側トレース（このポートで受信するソケットに絞り込む）
+  if (cfg.trace) {
+    devmem_trace_start(&trace, cfg.port, 0);
+  }
+
+  // 自動調整用の制御チャネル
+  // 認証が無く実行中の設定を変更できるため、既定ではループバックだけで待ち受ける
+  if (cfg.control_port > 0) {
+    struct server_config ctrl_cfg = cfg;
+    ctrl_cfg.bind_addr = cfg.control_bind;
+    ctrl_cfg.port = cfg.control_port;
+    int control_fd = create_listen_socket(&ctrl_cfg);
+    if (control_fd < 0 ||
+        devmem_control_start(&control, control_fd, stats, server_control_set,
+                             NULL) < 0) {
+      if (control_fd >= 0) {
+        close(control_fd);
+      }
+      close(server_fd);
+      devmem_stats_close(stats, cfg.shm_name);
+      return 1;
+    }
+    printf("Control channel on %s port %d\n", cfg.control_bind,
+           cfg.control_port);
+  }
+
+  // 接続受付ループ
+  // 通常モードでは最初の接続から測定時間が経過するか、全接続が閉じるまで
+  long long deadline = 0;
+  int accepted = 0, active = 0;
+  struct conn_result total;
+  memset(&total, 0, sizeof(total));
+
+  while (!stop_requested) {
+    if (report_requested) {
+      report_requested = 0;
+      print_cumulative_stats();
+    }
+
+    // 終了した受信スレッドを回収
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+      if (workers[i].in_use &&
+          __atomic_load_n(&workers[i].done, __ATOMIC_ACQUIRE)) {
+        reap_worker(&workers[i], accepted > 1 || cfg.daemon_mode,
+                    cfg.daemon_mode ? NULL : &total);
+        active--;
+      }
+    }
+
+    if (!cfg.daemon_mode && accepted > 0 &&
+        (active == 0 || get_time_us() >= deadline)) {
+      break;
+    }
+
+    // クライアント接続を待機（停止要求と期限を確認できるようタイムアウト付き）
+    struct pollfd pfd = {.fd = server_fd, .events = POLLIN};
+    int ret = poll(&pfd, 1, 100);
+    if (ret <= 0) {
+      if (ret < 0 && errno != EINTR) {
+        perror("poll failed");
+        break;
+      }
+      continue;
+    }
+
+    client_len = sizeof(client_addr);
+    client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+    if (client_fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("accept failed");
+      STATS_ADD(stats, errors_total, 1);
+      if (!cfg.daemon_mode) {
+        break;
+      }
+      usleep(100000);
+      continue;
+    }
+
+    struct conn_worker *w = NULL;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+      if (!workers[i].in_use) {
+        w = &workers[i];
+        break;
+      }
+    }
+    if (!w) {
+      fprintf(stderr, "Too many connections, rejecting\n");
+      close(client_fd);
+      continue;
+    }
+
+    // 測定開始（通常モードでは最初の接続を基準にする）
+    if (!cfg.daemon_mode && accepted == 0) {
+      deadline = get_time_us() + cfg.measurement_duration * 1000000LL;
+    }
+
+    apply_rcvbuf(client_fd);
+
+    memset(w, 0, sizeof(*w));
+    w->in_use = 1;
+    w->fd = client_fd;
+    w->id = ++accepted;
+    w->cfg = &cfg;
+    w->deadline = deadline;
+    w->ack = take_ack_port(&client_addr);
+    format_sockaddr(&client_addr, w->peer, sizeof(w->peer));
+
+    printf("Client connected from %s%s\n", w->peer,
+           w->ack ? " (latency acks)" : "");
+    STATS_ADD(stats, connections_total, 1);
+    STATS_ADD(stats, connections_active, 1);
+
+    if (start_worker(w) < 0) {
+      fprintf(stderr, "Failed to create receive thread\n");
+      close(client_fd);
+      STATS_ADD(stats, connections_active, -1);
+      w->in_use = 0;
+      continue;
+    }
+    active++;
+  }
+
+  // 残りの受信スレッドを停止（ブロッキング中のrecvmsgをshutdownで起こす）
+  for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    if (workers[i].in_use) {
+      shutdown(workers[i].fd, SHUT_RDWR);
+    }
+  }
+  for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    if (workers[i].in_use) {
+      reap_worker(&workers[i], accepted > 1 || cfg.daemon_mode,
+                  cfg.daemon_mode ? NULL : &total);
+    }
+  }
+
+  // 複数ストリームの合計
+  if (!cfg.daemon_mode && accepted > 1) {
+    char title[64];
+    snprintf(title, sizeof(title), "Aggregate Results (%d streams)", accepted);
+    print_results(&cfg, &total, title);
+  }
 
   // クリーンアップ
-  close(client_fd);
   close(server_fd);
+  if (cfg.control_port > 0) {
+    devmem_control_stop(&control);
+  }
+  if (cfg.daemon_mode) {
+    devmem_metrics_stop(&metrics);
+    print_cumulative_stats();
+  }
+  devmem_trace_stop(&trace);
+  devmem_stats_close(stats, cfg.shm_name);
 
   return 0;
-}
\ No newline at end of file
+}
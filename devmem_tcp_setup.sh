@@ -2,11 +2,31 @@
 
 # Device Memory TCP セットアップスクリプト
 # 使用方法: ./devmem_tcp_setup.sh <interface_name> <queue_number>
+#
+# 環境変数（低レイテンシ受信用のNAPI設定、devmem_server --wait-mode と併用）:
+#   NAPI_DEFER_HARD_IRQS  ハードIRQを再有効化するまでに許す空ポーリング回数（例: 2）
+#   GRO_FLUSH_TIMEOUT     GRO/NAPI遅延タイマー（ナノ秒、例: 200000）
+#   未指定なら変更しない。0を指定するとカーネル既定（IRQ駆動）に戻す
+#
+# 環境変数（複数ストリームのキュー固定、devmem_client --local addr:port と併用）:
+#   STREAM_QUEUES         ストリームiを割り当てるキューのカンマ区切りリスト（例: 15,14,13）
+#   STREAM_SRC_PORT_BASE  --local に指定した送信元ポート（既定: 40000）
+#   STREAM_LOCAL_ADDRS    --local に複数のアドレスを指定した場合、そのアドレスのカンマ区切りリスト
+#                         （クライアントと同じく、ストリームiの送信元はアドレス i%N、
+#                          ポート STREAM_SRC_PORT_BASE + i/N。未指定時はポート BASE+i のみで判定）
+#   RULES_STATE           このスクリプトが追加したntupleルールIDの記録先
+#                         （再実行時はここに記録したルールだけを削除する）
 
 set -e
 
 INTERFACE=${1:-eth1}
 QUEUE_NUM=${2:-15}
+NAPI_DEFER_HARD_IRQS=${NAPI_DEFER_HARD_IRQS:-}
+GRO_FLUSH_TIMEOUT=${GRO_FLUSH_TIMEOUT:-}
+STREAM_QUEUES=${STREAM_QUEUES:-}
+STREAM_SRC_PORT_BASE=${STREAM_SRC_PORT_BASE:-40000}
+STREAM_LOCAL_ADDRS=${STREAM_LOCAL_ADDRS:-}
+RULES_STATE=${RULES_STATE:-/run/devmem_tcp_setup.$INTERFACE.rules}
 
 echo "Setting up Device Memory TCP for interface: $INTERFACE, queue: $QUEUE_NUM"
 
@@ -133,21 +153,89 @@ optimize_system() {
         echo "Setting IRQ $IRQ_NUM affinity to CPU 0"
         echo 1 > /proc/irq/$IRQ_NUM/smp_affinity 2>/dev/null || true
     fi
+    
+    # busy poll用のNAPI設定（IRQを抑止し、アプリケーション側のポーリングに任せる）
+    # IRQ駆動の受信では遅延が増えるため、指定された場合だけ変更する
+    if [ ! -z "$NAPI_DEFER_HARD_IRQS" ]; then
+        echo "Setting napi_defer_hard_irqs=$NAPI_DEFER_HARD_IRQS for $INTERFACE..."
+        echo $NAPI_DEFER_HARD_IRQS > /sys/class/net/$INTERFACE/napi_defer_hard_irqs 2>/dev/null || {
+            echo "Warning: Could not set napi_defer_hard_irqs"
+        }
+    fi
+    if [ ! -z "$GRO_FLUSH_TIMEOUT" ]; then
+        echo "Setting gro_flush_timeout=$GRO_FLUSH_TIMEOUT for $INTERFACE..."
+        echo $GRO_FLUSH_TIMEOUT > /sys/class/net/$INTERFACE/gro_flush_timeout 2>/dev/null || {
+            echo "Warning: Could not set gro_flush_timeout"
+        }
+    fi
 }
 
 # フロー制御ルールの設定
+# ntupleルールを追加し、IDを記録する（失敗時は1を返す）
+add_flow_rule() {
+    local OUTPUT RULE_ID
+    OUTPUT=$(ethtool -N $INTERFACE "$@" 2>&1) || return 1
+    RULE_ID=$(echo "$OUTPUT" | sed -n 's/.*rule with ID \([0-9]*\).*/\1/p')
+    if [ ! -z "$RULE_ID" ]; then
+        echo $RULE_ID >> "$RULES_STATE"
+    fi
+}
+
+# 前回このスクリプトが追加したルールだけを削除（他の用途のルールは残す）
+delete_own_flow_rules() {
+    if [ ! -f "$RULES_STATE" ]; then
+        return
+    fi
+    for RULE in $(cat "$RULES_STATE"); do
+        ethtool -N $INTERFACE delete $RULE 2>/dev/null || true
+    done
+    rm -f "$RULES_STATE"
+}
+
 setup_flow_steering() {
     echo "Setting up flow steering rules..."
     
-    # 既存のルールをクリア
-    ethtool -N $INTERFACE delete 0 2>/dev/null || true
-    ethtool -N $INTERFACE delete 1 2>/dev/null || true
+    delete_own_flow_rules
     
-    # TCP フロー用のルール（ポート5201）
+    # ストリームごとの送信元でキューを固定（宛先ポートのルールより先に評価させる）
+    # 送信元はクライアントの --local と同じ割り当て（アドレスを巡回し、巡回ごとにポート+1）
+    if [ ! -z "$STREAM_QUEUES" ]; then
+        local ADDRS=(${STREAM_LOCAL_ADDRS//,/ })
+        local NUM_ADDRS=${#ADDRS[@]}
+        STREAM_IDX=0
+        for STREAM_QUEUE in ${STREAM_QUEUES//,/ }; do
+            if [ $NUM_ADDRS -gt 0 ]; then
+                SRC_ADDR=${ADDRS[$((STREAM_IDX % NUM_ADDRS))]}
+                SRC_PORT=$((STREAM_SRC_PORT_BASE + STREAM_IDX / NUM_ADDRS))
+                SRC_MATCH="src-ip $SRC_ADDR"
+                case $SRC_ADDR in
+                    *:*) FLOW_TYPES="tcp6" ;;
+                    *)   FLOW_TYPES="tcp4" ;;
+                esac
+            else
+                SRC_ADDR=any
+                SRC_PORT=$((STREAM_SRC_PORT_BASE + STREAM_IDX))
+                FLOW_TYPES="tcp4 tcp6"
+                SRC_MATCH=""
+            fi
+            echo "Adding flow steering rule for TCP src $SRC_ADDR port $SRC_PORT to queue $STREAM_QUEUE..."
+            for FLOW_TYPE in $FLOW_TYPES; do
+                add_flow_rule flow-type $FLOW_TYPE $SRC_MATCH src-port $SRC_PORT dst-port 5201 action $STREAM_QUEUE || {
+                    echo "Warning: $FLOW_TYPE flow steering rule for src $SRC_ADDR port $SRC_PORT failed"
+                }
+            done
+            STREAM_IDX=$((STREAM_IDX + 1))
+        done
+    fi
+    
+    # TCP フロー用のルール（ポート5201、IPv4/IPv6）
     echo "Adding flow steering rule for TCP port 5201 to queue $QUEUE_NUM..."
-    ethtool -N $INTERFACE flow-type tcp4 dst-port 5201 action $QUEUE_NUM 2>/dev/null || {
+    add_flow_rule flow-type tcp4 dst-port 5201 action $QUEUE_NUM || {
         echo "Warning: Flow steering rule configuration failed"
     }
+    add_flow_rule flow-type tcp6 dst-port 5201 action $QUEUE_NUM || {
+        echo "Warning: IPv6 flow steering rule configuration failed"
+    }
     
     # 現在のフロー制御ルールを表示
     echo "Current flow steering rules:"
@@ -183,6 +271,8 @@ verify_setup() {
     echo "TCP rmem_max: $(sysctl net.core.rmem_max 2>/dev/null || echo 'N/A')"
     echo "TCP wmem_max: $(sysctl net.core.wmem_max 2>/dev/null || echo 'N/A')"
     echo "Netdev max backlog: $(sysctl net.core.netdev_max_backlog 2>/dev/null || echo 'N/A')"
+    echo "napi_defer_hard_irqs: $(cat /sys/class/net/$INTERFACE/napi_defer_hard_irqs 2>/dev/null || echo 'N/A')"
+    echo "gro_flush_timeout: $(cat /sys/class/net/$INTERFACE/gro_flush_timeout 2>/dev/null || echo 'N/A')"
 }
 
 # テスト用dmabuf作成プログラムのコンパイル
@@ -229,15 +319,18 @@ main() {
     
     echo -e "\n=== Setup Complete ==="
     echo "You can now run the test programs:"
-    echo "Server: ./devmem_server [port] [duration_sec]"
-    echo "Client: ./devmem_client [server_ip] [port] [data_size] [duration_sec] [use_devmem]"
+    echo "Server: ./devmem_server [--wait-mode block|busypoll|epoll|spin] [port] [duration_sec]"
+    echo "Client: ./devmem_client [--streams N] [--local addr[:port],...] [server_ip] [port] [data_size] [duration_sec] [use_devmem]"
     echo ""
     echo "Example usage:"
     echo "Server side: ./devmem_server 5201 30"
     echo "Client side: ./devmem_client 192.168.1.100 5201 1048576 30 0"
+    echo "IPv6, 4 streams: ./devmem_client --streams 4 --local '[2001:db8::10]:40000' 2001:db8::1 5201 1048576 30 0"
     echo ""
     echo "Note: devmem functionality requires proper dmabuf setup and kernel support"
 }
 
-# スクリプトの実行
-main "$@"
+# スクリプトの実行（sourceされた場合は関数定義のみ）
+if [ "${BASH_SOURCE[0]}" = "$0" ]; then
+    main "$@"
+fi
@@ -0,0 +1,466 @@
+#include "devmem_trace.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// プローブ接続完了の待ち時間（bpftraceのコンパイルを含む）
+#define TRACE_ATTACH_TIMEOUT_MS 30000
+
+// 停止要求後に集計結果の出力を待つ時間
+#define TRACE_STOP_TIMEOUT_MS 10000
+
+#define TRACE_POLL_INTERVAL_MS 50
+
+// プローブ接続完了の目印（BEGINで出力する）
+#define TRACE_READY_MARKER "DEVMEM_TRACE_READY\n"
+
+#define TRACE_PROGRAM_MAX 8192
+
+enum probe_type {
+  PROBE_KFUNC,      // kprobe/kretprobe（関数がトレース可能か確認する）
+  PROBE_TRACEPOINT, // tracepoint（events/<category>/<name> を確認する）
+};
+
+// プローブ定義
+// bpftraceの位置引数: $1 = 対象プロセス, $2 = ローカルポート,
+// $3 = リモートポート（ネットワークバイトオーダー）
+struct trace_probe {
+  enum probe_type type;
+  const char *targets[2]; // すべて存在する場合のみ使う
+  const char *stat;       // 同じ統計の代替プローブは最初に見つかったものを使う
+  const char *program;
+  const char *cleanup; // END で消す作業用マップ
+};
+
+static const struct trace_probe probes[] = {
+    // データ到着（ソフト割り込み、またはバックログ処理）からrecvmsg戻りまで
+    // sk_data_ready は関数ポインタ経由なのでインライン化されない
+    {PROBE_KFUNC,
+     {"sock_def_readable", "tcp_recvmsg"},
+     "rx_ready_to_recv_us",
+     "kprobe:sock_def_readable\n"
+     "{\n"
+     "  $sk = (struct sock *)arg0;\n"
+     "  if (($2 == 0 || $sk->__sk_common.skc_num == $2) &&\n"
+     "      ($3 == 0 || $sk->__sk_common.skc_dport == $3) &&\n"
+     "      @rx_ready[arg0] == 0) {\n"
+     "    @rx_ready[arg0] = nsecs;\n"
+     "  }\n"
+     "}\n"
+     "kprobe:tcp_recvmsg /pid == $1/\n"
+     "{\n"
+     "  @rx_sk[tid] = arg0;\n"
+     "}\n"
+     "kretprobe:tcp_recvmsg /@rx_sk[tid] != 0/\n"
+     "{\n"
+     "  $ready = @rx_ready[@rx_sk[tid]];\n"
+     "  if ($ready != 0) {\n"
+     "    @rx_ready_to_recv_us = hist((nsecs - $ready) / 1000);\n"
+     "    delete(@rx_ready[@rx_sk[tid]]);\n"
+     "  }\n"
+     "  delete(@rx_sk[tid]);\n"
+     "}\n",
+     "  clear(@rx_ready);\n"
+     "  clear(@rx_sk);\n"},
+    // 受信: ユーザーバッファへのコピー
+    {PROBE_KFUNC,
+     {"skb_copy_datagram_iter"},
+     "rx_copied_bytes",
+     "kprobe:skb_copy_datagram_iter /pid == $1/\n"
+     "{\n"
+     "  @rx_copied_bytes = sum(arg3);\n"
+     "}\n",
+     NULL},
+    // 受信: devmem（dmabufのフラグをトークンとして渡す）
+    {PROBE_KFUNC,
+     {"tcp_recvmsg_dmabuf"},
+     "rx_devmem_bytes",
+     "kretprobe:tcp_recvmsg_dmabuf /pid == $1 && (int32)retval > 0/\n"
+     "{\n"
+     "  @rx_devmem_bytes = sum((int32)retval);\n"
+     "}\n",
+     NULL},
+    // 送信: zerocopyでskbに付けたバイト数
+    {PROBE_KFUNC,
+     {"skb_zerocopy_iter_stream"},
+     "tx_zerocopy_bytes",
+     "kprobe:skb_zerocopy_iter_stream /pid == $1/\n"
+     "{\n"
+     "  @tx_zerocopy_bytes = sum(arg3);\n"
+     "  @tx_zerocopy_skbs = count();\n"
+     "}\n",
+     NULL},
+    // 送信: zerocopyのフラグをコピーに戻した回数（ループバックや転送経路）
+    // 実行コンテキストが送信元と限らないためシステム全体で数える
+    {PROBE_KFUNC,
+     {"skb_copy_ubufs"},
+     "tx_zerocopy_copied",
+     "kprobe:skb_copy_ubufs\n"
+     "{\n"
+     "  @tx_zerocopy_copied = count();\n"
+     "}\n",
+     NULL},
+    // 送信: zerocopy完了通知（カーネルにより関数名が異なる）
+    {PROBE_KFUNC,
+     {"msg_zerocopy_complete"},
+     "tx_zerocopy_completions",
+     "kprobe:msg_zerocopy_complete\n"
+     "{\n"
+     "  @tx_zerocopy_completions = count();\n"
+     "}\n",
+     NULL},
+    {PROBE_KFUNC,
+     {"msg_zerocopy_callback"},
+     "tx_zerocopy_completions",
+     "kprobe:msg_zerocopy_callback\n"
+     "{\n"
+     "  @tx_zerocopy_completions = count();\n"
+     "}\n",
+     NULL},
+    // page_pool: 割り当て関数の呼び出し回数（キャッシュからの再利用を含む）
+    // フラグメント割り当てでは1ページに複数回呼ばれるため、ページ数とは一致しない
+    {PROBE_KFUNC,
+     {"page_pool_alloc_netmems"},
+     "pp_alloc",
+     "kprobe:page_pool_alloc_netmems\n"
+     "{\n"
+     "  @pp_alloc = count();\n"
+     "}\n",
+     NULL},
+    {PROBE_KFUNC,
+     {"page_pool_alloc_pages"},
+     "pp_alloc",
+     "kprobe:page_pool_alloc_pages\n"
+     "{\n"
+     "  @pp_alloc = count();\n"
+     "}\n",
+     NULL},
+    // page_pool: ページアロケータから新しく取得したページと返却したページ
+    {PROBE_TRACEPOINT,
+     {"page_pool/page_pool_state_hold"},
+     "pp_fresh",
+     "tracepoint:page_pool:page_pool_state_hold\n"
+     "{\n"
+     "  @pp_fresh = count();\n"
+     "}\n",
+     NULL},
+    {PROBE_TRACEPOINT,
+     {"page_pool/page_pool_state_release"},
+     "pp_released",
+     "tracepoint:page_pool:page_pool_state_release\n"
+     "{\n"
+     "  @pp_released = count();\n"
+     "}\n",
+     NULL},
+};
+
+#define NUM_PROBES ((int)(sizeof(probes) / sizeof(probes[0])))
+
+static const char *const tracefs_dirs[] = {
+    "/sys/kernel/tracing",
+    "/sys/kernel/debug/tracing",
+};
+
+// トレース可能な関数の一覧から、各プローブの関数の有無を調べる
+// available_filter_functions が読めない場合は /proc/kallsyms で代用する
+static void find_kfuncs(int found[][2]) {
+  char path[256], line[512];
+  FILE *fp = NULL;
+
+  for (size_t i = 0; i < sizeof(tracefs_dirs) / sizeof(tracefs_dirs[0]); i++) {
+    snprintf(path, sizeof(path), "%s/available_filter_functions",
+             tracefs_dirs[i]);
+    if ((fp = fopen(path, "r"))) {
+      break;
+    }
+  }
+  if (!fp && !(fp = fopen("/proc/kallsyms", "r"))) {
+    return;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    // "name [module]" または "address type name [module]"
+    char *saveptr = NULL;
+    char *name = strtok_r(line, " \t\n", &saveptr);
+    char *second = strtok_r(NULL, " \t\n", &saveptr);
+    if (second && strlen(second) == 1) {
+      name = strtok_r(NULL, " \t\n", &saveptr);
+    }
+    if (!name) {
+      continue;
+    }
+    for (int i = 0; i < NUM_PROBES; i++) {
+      for (int j = 0; j < 2 && probes[i].targets[j]; j++) {
+        if (probes[i].type == PROBE_KFUNC &&
+            strcmp(probes[i].targets[j], name) == 0) {
+          found[i][j] = 1;
+        }
+      }
+    }
+  }
+  fclose(fp);
+}
+
+static int tracepoint_exists(const char *name) {
+  char path[256];
+
+  for (size_t i = 0; i < sizeof(tracefs_dirs) / sizeof(tracefs_dirs[0]); i++) {
+    snprintf(path, sizeof(path), "%s/events/%s", tracefs_dirs[i], name);
+    if (access(path, F_OK) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// このカーネルで使えるプローブからbpftraceのプログラムを組み立てる
+// 戻り値は使ったプローブの数
+static int build_program(char *buf, size_t len) {
+  int found[NUM_PROBES][2];
+  const char *used_stats[NUM_PROBES];
+  int nused = 0;
+  size_t pos = 0;
+
+  memset(found, 0, sizeof(found));
+  find_kfuncs(found);
+
+  pos += snprintf(buf + pos, len - pos,
+                  "BEGIN\n{\n  printf(\"DEVMEM_TRACE_READY\\n\");\n}\n");
+
+  for (int i = 0; i < NUM_PROBES; i++) {
+    const struct trace_probe *p = &probes[i];
+    int available = 1, duplicate = 0;
+
+    for (int j = 0; j < 2 && p->targets[j]; j++) {
+      if (p->type == PROBE_TRACEPOINT ? !tracepoint_exists(p->targets[j])
+                                      : !found[i][j]) {
+        available = 0;
+      }
+    }
+    for (int k = 0; k < nused; k++) {
+      if (strcmp(used_stats[k], p->stat) == 0) {
+        duplicate = 1;
+      }
+    }
+    if (duplicate) {
+      continue;
+    }
+    // 代替プローブが後に続く場合はそちらを試す
+    if (!available) {
+      if (i + 1 >= NUM_PROBES || strcmp(probes[i + 1].stat, p->stat) != 0) {
+        printf("Kernel trace: %s unavailable on this kernel\n", p->stat);
+      }
+      continue;
+    }
+
+    used_stats[nused++] = p->stat;
+    pos += snprintf(buf + pos, len - pos, "%s", p->program);
+  }
+
+  pos += snprintf(buf + pos, len - pos, "END\n{\n");
+  for (int i = 0; i < NUM_PROBES; i++) {
+    for (int k = 0; k < nused; k++) {
+      if (probes[i].cleanup && strcmp(used_stats[k], probes[i].stat) == 0) {
+        pos += snprintf(buf + pos, len - pos, "%s", probes[i].cleanup);
+      }
+    }
+  }
+  snprintf(buf + pos, len - pos, "}\n");
+
+  return nused;
+}
+
+// 一時ファイルの offset 以降を読み込む（呼び出し側でfree）
+static char *read_output(int fd, long offset) {
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || st.st_size < offset) {
+    return NULL;
+  }
+  size_t len = st.st_size - offset;
+  char *buf = malloc(len + 1);
+  if (!buf) {
+    return NULL;
+  }
+  ssize_t n = pread(fd, buf, len, offset);
+  buf[n > 0 ? n : 0] = '\0';
+  return buf;
+}
+
+// 出力中の "@name: value" を探す
+static long long find_counter(const char *output, const char *name) {
+  char key[64];
+  const char *p;
+
+  snprintf(key, sizeof(key), "@%s: ", name);
+  p = strstr(output, key);
+  return p ? atoll(p + strlen(key)) : 0;
+}
+
+// 子プロセスの終了を timeout_ms まで待つ（終了した場合は1）
+static int wait_exit(pid_t pid, int timeout_ms) {
+  for (int waited = 0;; waited += TRACE_POLL_INTERVAL_MS) {
+    pid_t ret = waitpid(pid, NULL, WNOHANG);
+    if (ret == pid || (ret < 0 && errno != EINTR)) {
+      return 1;
+    }
+    if (waited >= timeout_ms) {
+      return 0;
+    }
+    usleep(TRACE_POLL_INTERVAL_MS * 1000);
+  }
+}
+
+int devmem_trace_start(struct devmem_trace *t, int local_port,
+                       int remote_port) {
+  static char program[TRACE_PROGRAM_MAX];
+  char tmpl[] = "/tmp/devmem_trace.XXXXXX";
+  char pid_arg[16], local_arg[16], remote_arg[16];
+  const char *bpftrace = getenv("BPFTRACE");
+
+  t->pid = -1;
+  t->fd = -1;
+  t->ready_offset = 0;
+  if (!bpftrace || !bpftrace[0]) {
+    bpftrace = "bpftrace";
+  }
+
+  int nprobes = build_program(program, sizeof(program));
+
+  // 出力は名前のない一時ファイルで受ける（子プロセスとファイルを共有する）
+  t->fd = mkstemp(tmpl);
+  if (t->fd < 0) {
+    perror("Kernel trace: mkstemp failed");
+    return -1;
+  }
+  unlink(tmpl);
+
+  snprintf(pid_arg, sizeof(pid_arg), "%d", (int)getpid());
+  snprintf(local_arg, sizeof(local_arg), "%d", local_port);
+  snprintf(remote_arg, sizeof(remote_arg), "%u",
+           (unsigned)htons((uint16_t)remote_port));
+  fflush(stdout);
+  fflush(stderr);
+
+  t->pid = fork();
+  if (t->pid < 0) {
+    perror("Kernel trace: fork failed");
+    close(t->fd);
+    t->fd = -1;
+    return -1;
+  }
+  if (t->pid == 0) {
+    // 端末からのSIGINTは受けず、停止は親が送るSIGINTで行う
+    // 親が異常終了した場合はトレースも終了させる
+    setpgid(0, 0);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    dup2(t->fd, STDOUT_FILENO);
+    dup2(t->fd, STDERR_FILENO);
+    execlp(bpftrace, bpftrace, "-B", "line", "-e", program, pid_arg,
+           local_arg, remote_arg, (char *)NULL);
+    fprintf(stderr, "cannot run %s: %s\n", bpftrace, strerror(errno));
+    _exit(127);
+  }
+
+  // BEGINの出力（全プローブ接続後）を待つ
+  for (int waited = 0; waited < TRACE_ATTACH_TIMEOUT_MS;
+       waited += TRACE_POLL_INTERVAL_MS) {
+    char *out = read_output(t->fd, 0);
+    char *ready = out ? strstr(out, TRACE_READY_MARKER) : NULL;
+    if (ready) {
+      t->ready_offset = ready - out + strlen(TRACE_READY_MARKER);
+      free(out);
+      printf("Kernel trace: %d probe groups attached (%s)\n", nprobes,
+             bpftrace);
+      return 0;
+    }
+
+    if (waitpid(t->pid, NULL, WNOHANG) == t->pid) {
+      fprintf(stderr, "Kernel trace unavailable, continuing without it:\n%s",
+              out ? out : "");
+      free(out);
+      t->pid = -1;
+      close(t->fd);
+      t->fd = -1;
+      return -1;
+    }
+    free(out);
+    usleep(TRACE_POLL_INTERVAL_MS * 1000);
+  }
+
+  fprintf(stderr, "Kernel trace: probes not attached after %d ms, "
+                  "continuing without it\n",
+          TRACE_ATTACH_TIMEOUT_MS);
+  kill(t->pid, SIGKILL);
+  waitpid(t->pid, NULL, 0);
+  t->pid = -1;
+  close(t->fd);
+  t->fd = -1;
+  return -1;
+}
+
+void devmem_trace_stop(struct devmem_trace *t) {
+  if (t->pid <= 0) {
+    return;
+  }
+
+  // SIGINTでbpftraceが集計マップを出力して終了する
+  kill(t->pid, SIGINT);
+  if (!wait_exit(t->pid, TRACE_STOP_TIMEOUT_MS)) {
+    fprintf(stderr, "Kernel trace: bpftrace did not exit, killing it\n");
+    kill(t->pid, SIGKILL);
+    waitpid(t->pid, NULL, 0);
+  }
+  t->pid = -1;
+
+  char *out = read_output(t->fd, t->ready_offset);
+  close(t->fd);
+  t->fd = -1;
+  if (!out) {
+    return;
+  }
+
+  char *body = out + strspn(out, "\n");
+  printf("\n=== Kernel Trace ===\n");
+  printf("%s", body[0] ? body : "No events\n");
+
+  // 集計値から求める比率
+  long long zc_skbs = find_counter(out, "tx_zerocopy_skbs");
+  long long zc_copied = find_counter(out, "tx_zerocopy_copied");
+  long long pp_alloc = find_counter(out, "pp_alloc");
+  long long pp_fresh = find_counter(out, "pp_fresh");
+  long long pp_released = find_counter(out, "pp_released");
+  if (zc_skbs > 0) {
+    printf("Zerocopy skbs copied: %lld of %lld (%.1f%%)\n", zc_copied, zc_skbs,
+           zc_copied * 100.0 / zc_skbs);
+  }
+  // ページアロケータとのやり取りはトレースポイントでページ単位に数える
+  if (pp_fresh > 0 || pp_released > 0) {
+    printf("page_pool pages: %lld taken from the page allocator, %lld "
+           "returned\n",
+           pp_fresh, pp_released);
+  }
+  // 再利用率は呼び出し回数（分母）とページ数（分子）の比なので近似値
+  // 単位の違いで新規ページが呼び出し回数を上回った場合は算出しない
+  if (pp_alloc > 0) {
+    if (pp_fresh <= pp_alloc) {
+      printf("page_pool recycle rate (approx.): %.1f%% (%lld allocation "
+             "calls, %lld fresh pages; fragment allocations count as calls)\n",
+             (1.0 - (double)pp_fresh / pp_alloc) * 100.0, pp_alloc, pp_fresh);
+    } else {
+      printf("page_pool recycle rate: n/a (%lld fresh pages exceed %lld "
+             "allocation calls)\n",
+             pp_fresh, pp_alloc);
+    }
+  }
+  fflush(stdout);
+  free(out);
+}
@@ -0,0 +1,34 @@
+#ifndef DEVMEM_TRACE_H
+#define DEVMEM_TRACE_H
+
+#include <sys/types.h>
+
+// カーネル側トレース（bpftraceを子プロセスとして実行期間中だけ動かす）
+// 受信経路・zerocopy送信・page_poolのプローブをカーネル内で集計し、
+// 終了時に結果を実行レポートへ追加する
+//
+//   受信: データ到着（sk_data_ready）からtcp_recvmsg戻りまでの時間の分布、
+//         ユーザーへコピーしたバイト数とdevmemで渡したバイト数
+//   送信: zerocopyで送ったバイト数、コピーに戻されたskb数、完了通知数
+//   page_pool: 割り当ての呼び出し数と、ページアロケータから取得・返却したページ数
+//              （再利用率は単位の異なる両者の比なので近似値）
+//
+// このカーネルにないプローブは省いて実行する（ループバックでも動く）
+// bpftraceのパスは環境変数 BPFTRACE で変更できる
+
+struct devmem_trace {
+  pid_t pid; // bpftraceのプロセス（-1: 未実行）
+  int fd;    // bpftraceの出力を受ける一時ファイル
+  long ready_offset; // 出力中の集計結果の開始位置
+};
+
+// トレースを開始し、プローブの接続完了まで待つ
+// local_port/remote_port は受信経路を絞り込むソケットのポート（0: 絞り込まない）
+// 起動できない場合は理由を表示して-1（呼び出し側はトレースなしで続行する）
+int devmem_trace_start(struct devmem_trace *t, int local_port,
+                       int remote_port);
+
+// トレースを停止し、集計結果を標準出力に表示
+void devmem_trace_stop(struct devmem_trace *t);
+
+#endif // DEVMEM_TRACE_H
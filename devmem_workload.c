@@ -0,0 +1,234 @@
+#include "devmem_workload.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 指数分布の打ち切り（平均の倍数）
+#define EXP_SIZE_CAP 8
+// on_ms/off_ms の上限（on_ms + off_ms がintに収まるように）
+#define BURST_MS_MAX (INT_MAX / 2)
+// 0以外のrateの下限（送信間隔のナノ秒がlong longに収まるように）
+#define RATE_MIN 0.001
+
+// splitmix64（フローごとの独立した乱数列）
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = (*state += 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// 整数を1つ解析（数字が無い・桁あふれ・[min, max] の範囲外は-1）
+// end には解析を終えた位置を返す
+static int parse_int(const char *s, char **end, long long min, long long max,
+                     int *out) {
+  errno = 0;
+  long long v = strtoll(s, end, 0);
+  if (*end == s || errno == ERANGE || v < min || v > max) {
+    return -1;
+  }
+  *out = v;
+  return 0;
+}
+
+// 文字列全体が [min, max] の整数であれば解析する
+static int parse_int_value(const char *s, long long min, long long max,
+                           int *out) {
+  char *end;
+  if (parse_int(s, &end, min, max, out) < 0 || *end != '\0') {
+    return -1;
+  }
+  return 0;
+}
+
+// "fixed:N" / "uniform:MIN-MAX" / "exp:MEAN" を解析
+static int parse_size(const char *spec, struct flow_class *c) {
+  char *end;
+
+  if (strncmp(spec, "fixed:", 6) == 0) {
+    c->dist = SIZE_FIXED;
+    if (parse_int_value(spec + 6, 1, INT_MAX, &c->size_min) < 0) {
+      return -1;
+    }
+    c->size_max = c->size_min;
+  } else if (strncmp(spec, "uniform:", 8) == 0) {
+    c->dist = SIZE_UNIFORM;
+    if (parse_int(spec + 8, &end, 1, INT_MAX, &c->size_min) < 0 ||
+        *end != '-' ||
+        parse_int_value(end + 1, c->size_min, INT_MAX, &c->size_max) < 0) {
+      return -1;
+    }
+  } else if (strncmp(spec, "exp:", 4) == 0) {
+    // 打ち切り値（平均の EXP_SIZE_CAP 倍）もintに収まる平均だけ受け付ける
+    c->dist = SIZE_EXP;
+    if (parse_int_value(spec + 4, 1, INT_MAX / EXP_SIZE_CAP, &c->size_min) <
+        0) {
+      return -1;
+    }
+    c->size_max = c->size_min * EXP_SIZE_CAP;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+// "key=value" を1つ解析
+static int parse_option(char *opt, struct flow_class *c, int *latency_set) {
+  char *value = strchr(opt, '=');
+  char *end;
+
+  if (!value) {
+    return -1;
+  }
+  *value++ = '\0';
+
+  if (strcmp(opt, "flows") == 0) {
+    return parse_int_value(value, 1, INT_MAX, &c->flows);
+  }
+  if (strcmp(opt, "size") == 0) {
+    return parse_size(value, c);
+  }
+  if (strcmp(opt, "rate") == 0) {
+    errno = 0;
+    c->rate = strtod(value, &end);
+    return end != value && *end == '\0' && errno != ERANGE &&
+                   isfinite(c->rate) && (c->rate == 0 || c->rate >= RATE_MIN)
+               ? 0
+               : -1;
+  }
+  if (strcmp(opt, "on_ms") == 0) {
+    return parse_int_value(value, 0, BURST_MS_MAX, &c->on_ms);
+  }
+  if (strcmp(opt, "off_ms") == 0) {
+    return parse_int_value(value, 0, BURST_MS_MAX, &c->off_ms);
+  }
+  if (strcmp(opt, "latency") == 0) {
+    *latency_set = 1;
+    return parse_int_value(value, 0, 1, &c->latency);
+  }
+  return -1;
+}
+
+int workload_parse(const char *path, struct workload *wl) {
+  char line[512];
+  int lineno = 0;
+  FILE *fp = fopen(path, "r");
+
+  if (!fp) {
+    perror("Cannot open workload file");
+    return -1;
+  }
+
+  memset(wl, 0, sizeof(*wl));
+
+  while (fgets(line, sizeof(line), fp)) {
+    char *saveptr = NULL, *tok;
+    struct flow_class c;
+    int latency_set = 0;
+
+    lineno++;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    tok = strtok_r(line, " \t\r\n", &saveptr);
+    if (!tok) {
+      continue; // 空行
+    }
+
+    if (wl->nclasses >= MAX_FLOW_CLASSES) {
+      fprintf(stderr, "%s:%d: too many flow classes (max %d)\n", path, lineno,
+              MAX_FLOW_CLASSES);
+      fclose(fp);
+      return -1;
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.flows = 1;
+    c.dist = SIZE_FIXED;
+    c.size_min = c.size_max = 65536;
+    snprintf(c.name, sizeof(c.name), "%s", tok);
+
+    while ((tok = strtok_r(NULL, " \t\r\n", &saveptr))) {
+      if (parse_option(tok, &c, &latency_set) < 0) {
+        fprintf(stderr, "%s:%d: invalid option '%s'\n", path, lineno, tok);
+        fclose(fp);
+        return -1;
+      }
+    }
+    if ((c.on_ms > 0) != (c.off_ms > 0)) {
+      fprintf(stderr, "%s:%d: on_ms and off_ms must be given together\n",
+              path, lineno);
+      fclose(fp);
+      return -1;
+    }
+    if (c.flows > INT_MAX - wl->total_flows) {
+      fprintf(stderr, "%s:%d: too many flows\n", path, lineno);
+      fclose(fp);
+      return -1;
+    }
+    // ペーシングやバーストのあるフローは応答時間が主な関心事
+    if (!latency_set) {
+      c.latency = c.rate > 0 || c.on_ms > 0;
+    }
+
+    wl->classes[wl->nclasses++] = c;
+    wl->total_flows += c.flows;
+  }
+  fclose(fp);
+
+  if (wl->nclasses == 0) {
+    fprintf(stderr, "%s: no flow classes defined\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int flow_class_max_size(const struct flow_class *c) { return c->size_max; }
+
+int flow_class_sample_size(const struct flow_class *c, uint64_t *rng) {
+  switch (c->dist) {
+  case SIZE_UNIFORM:
+    return c->size_min +
+           next_random(rng) % (uint64_t)(c->size_max - c->size_min + 1);
+  case SIZE_EXP: {
+    // 53ビットの一様乱数 (0, 1] から逆関数法で生成
+    double u = ((next_random(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double size = -log(u) * c->size_min;
+    if (size < 1) {
+      return 1;
+    }
+    return size > c->size_max ? c->size_max : (int)size;
+  }
+  case SIZE_FIXED:
+  default:
+    return c->size_min;
+  }
+}
+
+void flow_class_print(const struct flow_class *c) {
+  printf("  %-12s flows=%d size=", c->name, c->flows);
+  switch (c->dist) {
+  case SIZE_FIXED:
+    printf("fixed:%d", c->size_min);
+    break;
+  case SIZE_UNIFORM:
+    printf("uniform:%d-%d", c->size_min, c->size_max);
+    break;
+  case SIZE_EXP:
+    printf("exp:%d", c->size_min);
+    break;
+  }
+  if (c->rate > 0) {
+    printf(" rate=%g/s", c->rate);
+  }
+  if (c->on_ms > 0) {
+    printf(" on=%dms off=%dms", c->on_ms, c->off_ms);
+  }
+  printf("%s\n", c->latency ? " latency" : "");
+}
@@ -0,0 +1,58 @@
+#ifndef DEVMEM_WORKLOAD_H
+#define DEVMEM_WORKLOAD_H
+
+#include <stdint.h>
+
+// 混合ワークロードの定義
+// 同じ受信キュー（とdmabufのトークンプール）を共有するフローを種類ごとに記述する
+//
+// 設定ファイルは1行1クラス（# 以降はコメント）:
+//   <name> flows=N size=DIST [rate=MSGS_PER_SEC] [on_ms=N off_ms=N] [latency=0|1]
+//
+//   size:    fixed:N | uniform:MIN-MAX | exp:MEAN（指数分布、平均の8倍で打ち切り）
+//            サイズはintの範囲（expは打ち切り値がintに収まる平均）、範囲外は解析エラー
+//   rate:    1フローあたりのメッセージ送信レート（0または省略時は送れるだけ送る）
+//   on_ms/off_ms: オン/オフのバースト（オン期間だけ送信する）
+//   latency: サーバーの累積受信応答でメッセージ応答時間を測る
+//            （既定はrateかバーストを指定したクラスで有効）
+
+#define MAX_FLOW_CLASSES 16
+#define FLOW_CLASS_NAME_MAX 32
+
+enum size_dist {
+  SIZE_FIXED,
+  SIZE_UNIFORM,
+  SIZE_EXP,
+};
+
+struct flow_class {
+  char name[FLOW_CLASS_NAME_MAX];
+  int flows;
+  enum size_dist dist;
+  int size_min; // fixed: サイズ, uniform: 下限, exp: 平均
+  int size_max; // uniform: 上限
+  double rate;  // メッセージ/秒（0: 制限なし）
+  int on_ms;    // 0の場合は常にオン
+  int off_ms;
+  int latency;
+};
+
+struct workload {
+  struct flow_class classes[MAX_FLOW_CLASSES];
+  int nclasses;
+  int total_flows;
+};
+
+// 設定ファイルを読み込む（エラー時は行番号付きで表示して-1）
+int workload_parse(const char *path, struct workload *wl);
+
+// クラスが送る可能性のある最大のメッセージサイズ
+int flow_class_max_size(const struct flow_class *c);
+
+// メッセージサイズを1つ抽出（rng は呼び出し側が保持する乱数状態）
+int flow_class_sample_size(const struct flow_class *c, uint64_t *rng);
+
+// クラスの定義を1行で表示
+void flow_class_print(const struct flow_class *c);
+
+#endif // DEVMEM_WORKLOAD_H
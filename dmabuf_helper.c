@@ -1,20 +1,25 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <linux/memfd.h> // memfd_create, MFD_CLOEXEC
 #include <linux/udmabuf.h>
 #include <net/if.h> // ifreq
 #include <netlink/genl/ctrl.h>
 #include <netlink/genl/genl.h>
 #include <netlink/netlink.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "test_pattern.h"
+
 // TODO: correct?
 #define NETDEV_CMD_BIND_RX 1
 #define NETDEV_CMD_BIND_TX 2
@@ -30,8 +35,21 @@ struct dmabuf_info {
   size_t size;
   void *mapped_addr;
   uint32_t dmabuf_id;
+  struct nl_sock *nl_sk; // バインドを保持するnetlinkソケット（閉じるとアンバインド）
 };
 
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t info_requested = 0;
+
+// SIGTERM/SIGINT: 停止要求, SIGHUP: dmabuf情報の再表示
+static void signal_handler(int sig) {
+  if (sig == SIGHUP) {
+    info_requested = 1;
+  } else {
+    stop_requested = 1;
+  }
+}
+
 // udmabuf作成
 int create_udmabuf(size_t size, struct dmabuf_info *info) {
   int memfd, udmabuf_fd;
@@ -171,7 +189,9 @@ int bind_dmabuf_rx(const char *ifname, int ifindex, int queue_idx,
   printf("dmabuf bind request sent successfully\n");
 
   nlmsg_free(msg);
-  nl_socket_free(sk);
+
+  // バインドはnetlinkソケットの寿命に紐づくため、クリーンアップまで保持する
+  info->nl_sk = sk;
 
   return 0;
 }
@@ -237,31 +257,39 @@ int bind_dmabuf_tx(const char *ifname, int ifindex, struct dmabuf_info *info) {
   printf("dmabuf TX bind request sent successfully\n");
 
   nlmsg_free(msg);
-  nl_socket_free(sk);
+
+  // バインドはnetlinkソケットの寿命に紐づくため、クリーンアップまで保持する
+  info->nl_sk = sk;
 
   return 0;
 }
 
 // dmabufにテストデータを書き込み
-void fill_dmabuf_testdata(struct dmabuf_info *info) {
-  unsigned char *data = (unsigned char *)info->mapped_addr;
-  size_t i;
-
-  printf("Filling dmabuf with test data\n");
-
-  // 繰り返しパターンでデータを埋める
-  for (i = 0; i < info->size; i++) {
-    data[i] = (i % 256);
-  }
-
-  // メモリ同期
-  msync(info->mapped_addr, info->size, MS_SYNC);
-
-  printf("Test data filled: %zu bytes\n", info->size);
+// udmabufはmemfdのページをそのまま共有するため、書き込み後の同期は不要
+void fill_dmabuf_testdata(struct dmabuf_info *info, enum test_pattern pattern,
+                          uint64_t seed) {
+  struct timespec start, end;
+
+  printf("Filling dmabuf with test data (pattern %s)\n",
+         test_pattern_name(pattern));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int threads = test_pattern_fill_parallel(info->mapped_addr, info->size,
+                                           pattern, seed, 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("Test data filled: %zu bytes in %.3f ms (%d threads)\n", info->size,
+         (end.tv_sec - start.tv_sec) * 1000.0 +
+             (end.tv_nsec - start.tv_nsec) / 1000000.0,
+         threads);
 }
 
 // dmabufのクリーンアップ
 void cleanup_dmabuf(struct dmabuf_info *info) {
+  // netlinkソケットを閉じてdmabufをアンバインド
+  if (info->nl_sk) {
+    nl_socket_free(info->nl_sk);
+  }
   if (info->mapped_addr != MAP_FAILED && info->mapped_addr != NULL) {
     munmap(info->mapped_addr, info->size);
   }
@@ -297,6 +325,30 @@ int get_ifindex(const char *ifname) {
   return ifindex;
 }
 
+// dmabuf情報を表示
+static void print_dmabuf_info(const struct dmabuf_info *rx_dmabuf,
+                              const struct dmabuf_info *tx_dmabuf) {
+  printf("\nDmabuf Information:\n");
+  printf("RX dmabuf: fd=%d, size=%zu, mapped=%p\n", rx_dmabuf->fd,
+         rx_dmabuf->size, rx_dmabuf->mapped_addr);
+  printf("TX dmabuf: fd=%d, size=%zu, mapped=%p\n", tx_dmabuf->fd,
+         tx_dmabuf->size, tx_dmabuf->mapped_addr);
+  fflush(stdout);
+}
+
+// シグナルハンドラを設定
+// SA_RESTARTを付けず、getchar/sigsuspendをEINTRで中断させる
+static void setup_signals(void) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = signal_handler;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+}
+
 // メイン関数
 int main(int argc, char *argv[]) {
   struct dmabuf_info rx_dmabuf, tx_dmabuf;
@@ -304,20 +356,61 @@ int main(int argc, char *argv[]) {
   int queue_num = 15;
   size_t dmabuf_size = 1024 * 1024 * 16; // 16MB
   int ifindex;
+  int daemon_mode = 0;
+  enum test_pattern pattern = PATTERN_INCREMENT;
+  uint64_t seed = 1;
+  static const struct option long_options[] = {
+      {"daemon", no_argument, NULL, 'D'},
+      {"pattern", required_argument, NULL, 'p'},
+      {"seed", required_argument, NULL, 'S'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+  int opt;
 
   memset(&rx_dmabuf, 0, sizeof(rx_dmabuf));
   memset(&tx_dmabuf, 0, sizeof(tx_dmabuf));
 
-  if (argc > 1) {
-    ifname = argv[1];
+  while ((opt = getopt_long(argc, argv, "Dp:S:h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'D':
+      daemon_mode = 1;
+      break;
+    case 'p':
+      if (test_pattern_parse(optarg, &pattern) < 0) {
+        fprintf(stderr, "Unknown pattern: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'S':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [options] [interface] [queue] [dmabuf_size]\n"
+              "  -D, --daemon        keep dmabufs bound until SIGTERM "
+              "(SIGHUP prints info)\n"
+              "  -p, --pattern NAME  TX test data: increment | prng | "
+              "incompressible\n"
+              "  -S, --seed N        pattern seed (default 1)\n",
+              argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  // 従来どおりの位置引数
+  if (optind < argc) {
+    ifname = argv[optind++];
   }
-  if (argc > 2) {
-    queue_num = atoi(argv[2]);
+  if (optind < argc) {
+    queue_num = atoi(argv[optind++]);
   }
-  if (argc > 3) {
-    dmabuf_size = atoll(argv[3]);
+  if (optind < argc) {
+    dmabuf_size = atoll(argv[optind++]);
   }
 
+  setup_signals();
+
   printf("dmabuf helper for devmem TCP\n");
   printf("Interface: %s\n", ifname);
   printf("Queue: %d\n", queue_num);
@@ -345,7 +438,7 @@ int main(int argc, char *argv[]) {
   }
 
   // TX dmabufにテストデータを書き込み
-  fill_dmabuf_testdata(&tx_dmabuf);
+  fill_dmabuf_testdata(&tx_dmabuf, pattern, seed);
 
   // dmabufをネットワークデバイスにバインド
   printf("\nBinding dmabufs to network device...\n");
@@ -363,14 +456,35 @@ int main(int argc, char *argv[]) {
   }
 
   // dmabuf情報を表示
-  printf("\nDmabuf Information:\n");
-  printf("RX dmabuf: fd=%d, size=%zu, mapped=%p\n", rx_dmabuf.fd,
-         rx_dmabuf.size, rx_dmabuf.mapped_addr);
-  printf("TX dmabuf: fd=%d, size=%zu, mapped=%p\n", tx_dmabuf.fd,
-         tx_dmabuf.size, tx_dmabuf.mapped_addr);
-
-  printf("\nPress Enter to cleanup and exit...\n");
-  getchar();
+  print_dmabuf_info(&rx_dmabuf, &tx_dmabuf);
+
+  if (daemon_mode) {
+    // SIGTERMを受けるまでバインドを保持
+    printf("\nDaemon mode: send SIGTERM to cleanup and exit\n");
+    fflush(stdout);
+
+    // フラグの確認から待機までの間に届いたシグナルを取りこぼさないよう、
+    // ブロックしておき sigsuspend で元のマスクに戻して待つ
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGHUP);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    while (!stop_requested) {
+      if (info_requested) {
+        info_requested = 0;
+        print_dmabuf_info(&rx_dmabuf, &tx_dmabuf);
+        fflush(stdout);
+        continue;
+      }
+      sigsuspend(&old);
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+  } else {
+    printf("\nPress Enter to cleanup and exit...\n");
+    getchar();
+  }
 
   // クリーンアップ
   cleanup_dmabuf(&rx_dmabuf);
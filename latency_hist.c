@@ -0,0 +1,46 @@
+#include "latency_hist.h"
+
+void latency_hist_add(struct latency_hist *h, long long ns) {
+  int bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && (1LL << (bucket + 1)) <= ns) {
+    bucket++;
+  }
+  h->buckets[bucket]++;
+  h->count++;
+  h->sum_ns += ns;
+  if (ns > h->max_ns) {
+    h->max_ns = ns;
+  }
+}
+
+void latency_hist_merge(struct latency_hist *dst,
+                        const struct latency_hist *src) {
+  dst->count += src->count;
+  dst->sum_ns += src->sum_ns;
+  if (src->max_ns > dst->max_ns) {
+    dst->max_ns = src->max_ns;
+  }
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+}
+
+double latency_hist_percentile(const struct latency_hist *h, double p) {
+  long long target, seen = 0;
+
+  if (h->count == 0) {
+    return 0;
+  }
+  target = (long long)(h->count * p / 100.0);
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    if (seen + h->buckets[i] > target) {
+      double lo = i == 0 ? 0 : (double)(1LL << i);
+      double hi = (double)(1LL << (i + 1));
+      double frac = (double)(target - seen) / h->buckets[i];
+      double value = lo + (hi - lo) * frac;
+      return value < h->max_ns ? value : h->max_ns;
+    }
+    seen += h->buckets[i];
+  }
+  return h->max_ns;
+}
@@ -0,0 +1,23 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+// 待ち時間・応答時間のヒストグラム（2のべき乗ごとのバケット、ナノ秒）
+#define LATENCY_BUCKETS 48
+
+struct latency_hist {
+  long long count;
+  long long sum_ns;
+  long long max_ns;
+  long long buckets[LATENCY_BUCKETS];
+};
+
+void latency_hist_add(struct latency_hist *h, long long ns);
+
+// src の内容を dst に加算
+void latency_hist_merge(struct latency_hist *dst,
+                        const struct latency_hist *src);
+
+// パーセンタイル値（バケット内は線形補間）
+double latency_hist_percentile(const struct latency_hist *h, double p);
+
+#endif // LATENCY_HIST_H
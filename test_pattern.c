@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include "test_pattern.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// 1スレッドあたりの最小担当サイズ（これ未満はスレッド生成のほうが高くつく）
+#define PARALLEL_MIN_CHUNK (16UL * 1024 * 1024)
+#define PARALLEL_MAX_THREADS 64
+// 透過的ヒュージページ（x86_64/arm64の2MB）単位で分割し、1つのヒュージページを
+// 複数スレッドが同時にフォルトさせないようにする
+#define HUGE_PAGE_ALIGN (2UL * 1024 * 1024)
+
+// 4ワード（32バイト）単位で生成するためのベクタ型
+// AVX2環境では1命令、SSE2環境では2命令に展開される
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+typedef uint8_t u8x32 __attribute__((vector_size(32)));
+
+static const char *const pattern_names[] = {
+    [PATTERN_INCREMENT] = "increment",
+    [PATTERN_PRNG] = "prng",
+    [PATTERN_INCOMPRESSIBLE] = "incompressible",
+};
+
+int test_pattern_parse(const char *name, enum test_pattern *pattern) {
+  for (size_t i = 0; i < sizeof(pattern_names) / sizeof(pattern_names[0]);
+       i++) {
+    if (strcmp(name, pattern_names[i]) == 0) {
+      *pattern = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *test_pattern_name(enum test_pattern pattern) {
+  return pattern_names[pattern];
+}
+
+#define FILL_VECTOR_LOOP(EXPR)                                                 \
+  for (; i + 4 <= nwords; i += 4) {                                            \
+    u64x4 x = (EXPR);                                                          \
+    memcpy(dst + i * 8, &x, sizeof(x));                                        \
+    idx += 4;                                                                  \
+  }
+
+// ワード w から nwords 個のワードを dst に書き込む
+static void fill_words(uint8_t *dst, uint64_t w, size_t nwords,
+                       enum test_pattern pattern, uint64_t seed) {
+  size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  u64x4 idx = {w, w + 1, w + 2, w + 3};
+  u64x4 t;
+
+  switch (pattern) {
+  case PATTERN_PRNG:
+    FILL_VECTOR_LOOP((t = (idx + seed) * 0x9e3779b97f4a7c15ULL, t ^ (t >> 29)));
+    break;
+  case PATTERN_INCOMPRESSIBLE:
+    FILL_VECTOR_LOOP((t = seed + (idx + 1) * 0x9e3779b97f4a7c15ULL,
+                      t = (t ^ (t >> 30)) * 0xbf58476d1ce4e5b9ULL,
+                      t = (t ^ (t >> 27)) * 0x94d049bb133111ebULL,
+                      t ^ (t >> 31)));
+    break;
+  case PATTERN_INCREMENT:
+  default: {
+    // 256バイト周期なのでバイト単位の加算（桁あふれで自然に周回）で生成する
+    u8x32 v;
+    for (int k = 0; k < 32; k++) {
+      v[k] = (uint8_t)(w * 8 + k);
+    }
+    for (; i + 4 <= nwords; i += 4) {
+      memcpy(dst + i * 8, &v, sizeof(v));
+      v += 32;
+    }
+    break;
+  }
+  }
+#endif
+
+  // 端数（ビッグエンディアンでは全体）はスカラーで処理
+  for (; i < nwords; i++) {
+    uint64_t x = test_pattern_word(pattern, seed, w + i);
+    for (int k = 0; k < 8; k++) {
+      dst[i * 8 + k] = x >> (k * 8);
+    }
+  }
+}
+
+void test_pattern_fill(void *buf, size_t len, uint64_t offset,
+                       enum test_pattern pattern, uint64_t seed) {
+  uint8_t *dst = buf;
+  size_t pos = 0;
+
+  // ワード境界まで
+  while (pos < len && (offset + pos) % 8 != 0) {
+    dst[pos] = test_pattern_byte(pattern, seed, offset + pos);
+    pos++;
+  }
+
+  size_t nwords = (len - pos) / 8;
+  fill_words(dst + pos, (offset + pos) / 8, nwords, pattern, seed);
+  pos += nwords * 8;
+
+  // 末尾の端数
+  while (pos < len) {
+    dst[pos] = test_pattern_byte(pattern, seed, offset + pos);
+    pos++;
+  }
+}
+
+struct fill_task {
+  pthread_t thread;
+  uint8_t *base;
+  size_t start;
+  size_t end;
+  enum test_pattern pattern;
+  uint64_t seed;
+};
+
+static void *fill_thread(void *arg) {
+  struct fill_task *t = arg;
+  test_pattern_fill(t->base + t->start, t->end - t->start, t->start,
+                    t->pattern, t->seed);
+  return NULL;
+}
+
+// sysfsの "0-3,8-11" 形式のリストを読む（読めなければ-1）
+static int read_cpulist(const char *path, cpu_set_t *set) {
+  char buf[4096];
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    return -1;
+  }
+  if (!fgets(buf, sizeof(buf), f)) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  CPU_ZERO(set);
+  char *p = buf;
+  while (*p && *p != '\n') {
+    char *end;
+    long lo = strtol(p, &end, 10), hi = lo;
+    if (end == p) {
+      return -1;
+    }
+    p = end;
+    if (*p == '-') {
+      hi = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+      CPU_SET(c, set);
+    }
+    if (*p == ',') {
+      p++;
+    }
+  }
+  return 0;
+}
+
+// 実行を許されたCPUをNUMAノード順に並べる（ノード情報が無ければCPU番号順）
+// 連続する担当領域が同じノードのCPUに割り当たるようにするため
+static int numa_cpu_order(int *cpus, int max) {
+  cpu_set_t allowed, nodes, node_cpus;
+  char path[64];
+  int n = 0;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return 0;
+  }
+  if (read_cpulist("/sys/devices/system/node/online", &nodes) == 0) {
+    for (int node = 0; node < CPU_SETSIZE; node++) {
+      if (!CPU_ISSET(node, &nodes)) {
+        continue;
+      }
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+               node);
+      if (read_cpulist(path, &node_cpus) < 0) {
+        continue;
+      }
+      for (int c = 0; c < CPU_SETSIZE && n < max; c++) {
+        if (CPU_ISSET(c, &node_cpus) && CPU_ISSET(c, &allowed)) {
+          cpus[n++] = c;
+        }
+      }
+    }
+  }
+  if (n == 0) {
+    for (int c = 0; c < CPU_SETSIZE && n < max; c++) {
+      if (CPU_ISSET(c, &allowed)) {
+        cpus[n++] = c;
+      }
+    }
+  }
+  return n;
+}
+
+// スレッドを cpu に固定して開始（固定できなければ固定せずに開始）
+static int start_fill_thread(struct fill_task *t, int cpu) {
+  if (cpu >= 0) {
+    pthread_attr_t attr;
+    cpu_set_t set;
+    int ret;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_attr_init(&attr);
+    ret = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    if (ret == 0) {
+      ret = pthread_create(&t->thread, &attr, fill_thread, t);
+    }
+    pthread_attr_destroy(&attr);
+    if (ret == 0) {
+      return 0;
+    }
+  }
+  return pthread_create(&t->thread, NULL, fill_thread, t);
+}
+
+int test_pattern_fill_parallel(void *buf, size_t len,
+                               enum test_pattern pattern, uint64_t seed,
+                               int nthreads) {
+  struct fill_task tasks[PARALLEL_MAX_THREADS];
+  int cpus[CPU_SETSIZE];
+  int started = 0;
+
+  if (nthreads <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t by_size = len / PARALLEL_MIN_CHUNK;
+    nthreads = ncpu > 0 ? ncpu : 1;
+    if ((size_t)nthreads > by_size) {
+      nthreads = by_size > 0 ? by_size : 1;
+    }
+  }
+  if (nthreads > PARALLEL_MAX_THREADS) {
+    nthreads = PARALLEL_MAX_THREADS;
+  }
+
+  if (nthreads == 1) {
+    test_pattern_fill(buf, len, 0, pattern, seed);
+    return 1;
+  }
+
+  // 各スレッドをノード順に並べたCPUへ均等に割り当てて固定する
+  // ページは最初に書き込んだスレッドのノードに置かれるため（first-touch）、
+  // バッファはCPU数に比例して各ノードへ分散する
+  int ncpus = numa_cpu_order(cpus, CPU_SETSIZE);
+
+  // 担当領域をヒュージページ境界で区切り、同じページを複数スレッドが触らないようにする
+  size_t chunk =
+      (len / nthreads + HUGE_PAGE_ALIGN - 1) & ~(HUGE_PAGE_ALIGN - 1);
+  for (int i = 0; i < nthreads; i++) {
+    struct fill_task *t = &tasks[i];
+    t->base = buf;
+    t->start = chunk * i;
+    t->end = t->start + chunk < len ? t->start + chunk : len;
+    t->pattern = pattern;
+    t->seed = seed;
+    if (t->start >= len) {
+      break;
+    }
+    int cpu = ncpus > 0 ? cpus[(long)i * ncpus / nthreads] : -1;
+    if (start_fill_thread(t, cpu) != 0) {
+      // スレッドを作れない場合は残りを呼び出し元で処理
+      test_pattern_fill(t->base + t->start, len - t->start, t->start, pattern,
+                        seed);
+      break;
+    }
+    started++;
+  }
+
+  for (int i = 0; i < started; i++) {
+    pthread_join(tasks[i].thread, NULL);
+  }
+
+  return started > 0 ? started : 1;
+}
+
+ssize_t test_pattern_verify(const void *buf, size_t len, uint64_t offset,
+                            enum test_pattern pattern, uint64_t seed) {
+  const uint8_t *src = buf;
+  uint8_t expected[4096];
+
+  for (size_t pos = 0; pos < len; pos += sizeof(expected)) {
+    size_t n = len - pos < sizeof(expected) ? len - pos : sizeof(expected);
+    test_pattern_fill(expected, n, offset + pos, pattern, seed);
+    if (memcmp(src + pos, expected, n) != 0) {
+      for (size_t i = 0; i < n; i++) {
+        if (src[pos + i] != expected[i]) {
+          return pos + i;
+        }
+      }
+    }
+  }
+
+  return -1;
+}
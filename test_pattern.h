@@ -0,0 +1,71 @@
+#ifndef TEST_PATTERN_H
+#define TEST_PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// 送受信テスト用のデータパターン生成器
+// ストリーム上のオフセットから期待値をO(1)で求められるため、
+// 送信側はバッファを一括生成し、受信側は任意位置から検証できる
+
+enum test_pattern {
+  PATTERN_INCREMENT,      // offset % 256（従来の i % 256 と同じ）
+  PATTERN_PRNG,           // シード付きの軽量な擬似乱数
+  PATTERN_INCOMPRESSIBLE, // splitmix64による圧縮不能なデータ
+};
+
+// パターン名を解析（"increment" / "prng" / "incompressible"）
+int test_pattern_parse(const char *name, enum test_pattern *pattern);
+
+const char *test_pattern_name(enum test_pattern pattern);
+
+// 8バイトワード w の値（リトルエンディアンでバイト列に展開される）
+static inline uint64_t test_pattern_word(enum test_pattern pattern,
+                                         uint64_t seed, uint64_t w) {
+  uint64_t x;
+
+  switch (pattern) {
+  case PATTERN_PRNG:
+    x = (w + seed) * 0x9e3779b97f4a7c15ULL;
+    return x ^ (x >> 29);
+  case PATTERN_INCOMPRESSIBLE:
+    x = seed + (w + 1) * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  case PATTERN_INCREMENT:
+  default:
+    x = (w * 8) & 0xff;
+    // バイトkは x + k（xは8の倍数なので桁上がりしない）
+    return x * 0x0101010101010101ULL + 0x0706050403020100ULL;
+  }
+}
+
+// ストリームオフセット offset にあるべきバイト値
+static inline uint8_t test_pattern_byte(enum test_pattern pattern,
+                                        uint64_t seed, uint64_t offset) {
+  if (pattern == PATTERN_INCREMENT) {
+    return offset & 0xff;
+  }
+  return test_pattern_word(pattern, seed, offset / 8) >> ((offset % 8) * 8);
+}
+
+// buf[i] = test_pattern_byte(pattern, seed, offset + i) となるよう埋める
+void test_pattern_fill(void *buf, size_t len, uint64_t offset,
+                       enum test_pattern pattern, uint64_t seed);
+
+// 複数スレッドで分割して埋める（担当領域はヒュージページ境界で区切る）
+// 各スレッドは実行可能なCPUをNUMAノード順に均等に割り当てて固定するため、
+// 未確定のページはfirst-touchで担当スレッドのノードに置かれる
+// nthreads が0以下の場合はバッファサイズとCPU数から決める
+int test_pattern_fill_parallel(void *buf, size_t len,
+                               enum test_pattern pattern, uint64_t seed,
+                               int nthreads);
+
+// buf がストリームオフセット offset からの期待値と一致するか検証
+// 一致すれば -1、そうでなければ最初に不一致となったバッファ内の位置を返す
+ssize_t test_pattern_verify(const void *buf, size_t len, uint64_t offset,
+                            enum test_pattern pattern, uint64_t seed);
+
+#endif // TEST_PATTERN_H